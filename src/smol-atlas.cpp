@@ -5,11 +5,75 @@
 
 #include <assert.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include <vector>
 #include <type_traits>
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Best shelf search is vectorized with AVX2, SSE2 (plus SSE4.1 if available)
+// or NEON, depending on what the compiler targets. Define SMOL_ATLAS_NO_SIMD
+// to 1 to always use the scalar code path.
+#ifndef SMOL_ATLAS_NO_SIMD
+#define SMOL_ATLAS_NO_SIMD 0
+#endif
+#if !SMOL_ATLAS_NO_SIMD && defined(__AVX2__)
+#define SMOL_SIMD_AVX2 1
+#include <immintrin.h>
+#elif !SMOL_ATLAS_NO_SIMD && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SMOL_SIMD_SSE2 1
+#include <emmintrin.h>
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+#if defined(__F16C__)
+#include <immintrin.h> // half float conversions in sma_atlas_write_uvs
+#endif
+#elif !SMOL_ATLAS_NO_SIMD && (defined(__ARM_NEON) || defined(_M_ARM64)) && (defined(__aarch64__) || defined(_M_ARM64))
+#define SMOL_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Item and free span coordinates are stored in `smol_coord_t`. If your atlases
+// are never larger than 65535 pixels in either dimension, define
+// SMOL_ATLAS_16BIT_COORDS to 1 when compiling this file; that makes the items
+// use 24 instead of 32 bytes of memory (on 64 bit platforms).
+#ifndef SMOL_ATLAS_16BIT_COORDS
+#define SMOL_ATLAS_16BIT_COORDS 0
+#endif
+
+// Define SMOL_ATLAS_CONCURRENT_READS to 1 when compiling this file to make
+// `sma_item_rect` safe to call from other threads while the atlas is being
+// modified. Each item then also keeps a copy of its rectangle for such reads,
+// which makes items 8 (with 16 bit coordinates) or 24 bytes larger.
+#ifndef SMOL_ATLAS_CONCURRENT_READS
+#define SMOL_ATLAS_CONCURRENT_READS 0
+#endif
+
+#if SMOL_ATLAS_16BIT_COORDS
+typedef uint16_t smol_coord_t;
+static constexpr int SMOL_MAX_ATLAS_SIZE = 0xFFFF;
+#else
+typedef int smol_coord_t;
+static constexpr int SMOL_MAX_ATLAS_SIZE = 0x7FFFFFFF;
+#endif
+
 // "memory pool" that allocates chunks of same size items,
 // and maintains a freelist of items for O(1) alloc and free.
+// Items that were never used are handed out by bumping an index through
+// the chunks in order, before new chunks are allocated; that makes `clear`
+// O(1), it just starts bumping from the first chunk again.
+// Each new chunk is as large as all the previous ones together (up to
+// SMOL_POOL_MAX_CHUNK items), so a growing pool needs few chunk allocations.
+// Chunks that have no used items can be given back with `trim`.
+static constexpr size_t SMOL_POOL_MAX_CHUNK = 64 * 1024;
+
 template <typename T>
 struct smol_pool_t
 {
@@ -28,31 +92,29 @@ struct smol_pool_t
         size_t m_size_in_items;
         chunk_t(size_t size_in_items) : storage(new item_t[size_in_items]), m_size_in_items(size_in_items)
         {
-            link_all_items(nullptr);
         }
         ~chunk_t() { delete[] storage; }
-
-        void link_all_items(item_t* last_item_next_ptr)
-        {
-            for (size_t i = 1; i < m_size_in_items; ++i)
-                storage[i - 1].next = &storage[i];
-            storage[m_size_in_items - 1].next = last_item_next_ptr;
-        }
     };
 
     size_t m_chunk_size_in_items;
-    chunk_t* m_cur_chunk = nullptr;
+    chunk_t* m_first_chunk = nullptr;
+    chunk_t* m_last_chunk = nullptr;
     item_t* m_free_list = nullptr;
+    chunk_t* m_bump_chunk = nullptr; // items from m_bump_index on, and all later chunks, were never used
+    size_t m_bump_index = 0;
+    size_t m_capacity = 0;
+    size_t m_chunk_count = 0;
+    size_t m_used = 0;
+    size_t m_high_water = 0;
 
     smol_pool_t(size_t size_in_items)
         : m_chunk_size_in_items(size_in_items)
-        , m_cur_chunk(new chunk_t(size_in_items))
-        , m_free_list(m_cur_chunk->storage)
     {
+        add_chunk(size_in_items);
     }
     ~smol_pool_t()
     {
-        chunk_t* chunk = m_cur_chunk;
+        chunk_t* chunk = m_first_chunk;
         while (chunk) {
             chunk_t* next = chunk->next;
             delete chunk;
@@ -63,28 +125,74 @@ struct smol_pool_t
     // makes all items "unused", but keeps the allocated space
     void clear()
     {
-        chunk_t* chunk = m_cur_chunk;
-        while (chunk) {
-            chunk_t* next = chunk->next;
-            chunk->link_all_items(next ? next->storage : nullptr);
-            chunk = next;
-        }
-        m_free_list = m_cur_chunk ? m_cur_chunk->storage : nullptr;
+        m_free_list = nullptr;
+        m_bump_chunk = m_first_chunk;
+        m_bump_index = 0;
+        m_used = 0;
     }
 
-    template <typename... Args> T* alloc(Args &&... args)
+    void swap(smol_pool_t& other)
+    {
+        std::swap(m_chunk_size_in_items, other.m_chunk_size_in_items);
+        std::swap(m_first_chunk, other.m_first_chunk);
+        std::swap(m_last_chunk, other.m_last_chunk);
+        std::swap(m_free_list, other.m_free_list);
+        std::swap(m_bump_chunk, other.m_bump_chunk);
+        std::swap(m_bump_index, other.m_bump_index);
+        std::swap(m_capacity, other.m_capacity);
+        std::swap(m_chunk_count, other.m_chunk_count);
+        std::swap(m_used, other.m_used);
+        // high water mark stays with the owner, but has to cover the new contents
+        m_high_water = std::max(m_high_water, m_used);
+        other.m_high_water = std::max(other.m_high_water, other.m_used);
+    }
+
+    void add_chunk(size_t size_in_items)
     {
-        // create a new chunk if current one is full
-        if (m_free_list == nullptr) {
-            chunk_t* new_chunk = new chunk_t(m_chunk_size_in_items);
-            new_chunk->next = m_cur_chunk;
-            m_cur_chunk = new_chunk;
-            m_free_list = m_cur_chunk->storage;
+        chunk_t* new_chunk = new chunk_t(size_in_items);
+        // start bumping in the new chunk if all the previous ones are used up
+        if (m_bump_chunk == nullptr || (m_bump_chunk == m_last_chunk && m_bump_index == m_bump_chunk->m_size_in_items)) {
+            m_bump_chunk = new_chunk;
+            m_bump_index = 0;
         }
+        if (m_last_chunk)
+            m_last_chunk->next = new_chunk;
+        else
+            m_first_chunk = new_chunk;
+        m_last_chunk = new_chunk;
+        m_capacity += size_in_items;
+        ++m_chunk_count;
+    }
+
+    // makes sure there is space for this many items without further allocations
+    void reserve(size_t size_in_items)
+    {
+        if (size_in_items > m_capacity)
+            add_chunk(size_in_items - m_capacity);
+    }
 
-        // grab item from free list
+    template <typename... Args> T* alloc(Args &&... args)
+    {
+        // grab item from free list, or a never used one
         item_t* item = m_free_list;
-        m_free_list = item->next;
+        if (item != nullptr) {
+            m_free_list = item->next;
+        }
+        else {
+            if (m_bump_chunk == nullptr || m_bump_index == m_bump_chunk->m_size_in_items) {
+                // go to next chunk, or create a new one if all are used
+                if (m_bump_chunk != nullptr && m_bump_chunk->next != nullptr) {
+                    m_bump_chunk = m_bump_chunk->next;
+                    m_bump_index = 0;
+                }
+                else {
+                    add_chunk(std::max(m_chunk_size_in_items, std::min(m_capacity, SMOL_POOL_MAX_CHUNK)));
+                }
+            }
+            item = &m_bump_chunk->storage[m_bump_index++];
+        }
+        if (++m_used > m_high_water)
+            m_high_water = m_used;
 
         // construct the object
         T* res = reinterpret_cast<T*>(item->data);
@@ -92,13 +200,106 @@ struct smol_pool_t
         return res;
     }
 
+    // calls `func` for all items that were handed out since creation or last clear
+    // (used or freed since), in memory order
+    template <typename F> void for_each_slot(F func)
+    {
+        for (chunk_t* chunk = m_first_chunk; chunk; chunk = chunk->next) {
+            const size_t count = chunk == m_bump_chunk ? m_bump_index : chunk->m_size_in_items;
+            for (size_t i = 0; i < count; ++i)
+                func(reinterpret_cast<T*>(chunk->storage[i].data));
+            if (chunk == m_bump_chunk)
+                break;
+        }
+    }
+
     void free(T* ptr)
     {
         // add item to the free list
         item_t* item = reinterpret_cast<item_t*>(ptr);
         item->next = m_free_list;
         m_free_list = item;
+        --m_used;
+    }
+
+    // Deletes chunks that have no used items, and resets the high water mark.
+    // Returns the number of bytes released.
+    size_t trim()
+    {
+        m_high_water = m_used;
+        if (m_chunk_count == 0)
+            return 0;
+
+        // count free items of each chunk: never used ones, and ones in the
+        // free list (chunks sorted by address to find them)
+        struct chunk_info_t
+        {
+            const item_t* storage;
+            size_t size;
+            size_t free_count;
+        };
+        std::vector<chunk_info_t> chunks;
+        chunks.reserve(m_chunk_count);
+        bool after_bump = false;
+        for (chunk_t* chunk = m_first_chunk; chunk; chunk = chunk->next) {
+            size_t never_used = 0;
+            if (chunk == m_bump_chunk) {
+                never_used = chunk->m_size_in_items - m_bump_index;
+                after_bump = true;
+            }
+            else if (after_bump) {
+                never_used = chunk->m_size_in_items;
+            }
+            chunks.push_back({ chunk->storage, chunk->m_size_in_items, never_used });
+        }
+        std::sort(chunks.begin(), chunks.end(), [](const chunk_info_t& a, const chunk_info_t& b) { return a.storage < b.storage; });
+        auto find_chunk = [&](const item_t* item) -> chunk_info_t& {
+            auto it = std::upper_bound(chunks.begin(), chunks.end(), item, [](const item_t* p, const chunk_info_t& c) { return p < c.storage; });
+            return *(it - 1);
+        };
+        for (item_t* item = m_free_list; item; item = item->next)
+            ++find_chunk(item).free_count;
+
+        size_t released_items = 0;
+        for (const chunk_info_t& info : chunks) {
+            if (info.free_count == info.size)
+                released_items += info.size;
+        }
+        if (released_items == 0)
+            return 0;
+
+        // take items of released chunks out of the free list
+        item_t** link = &m_free_list;
+        while (item_t* item = *link) {
+            const chunk_info_t& info = find_chunk(item);
+            if (info.free_count == info.size)
+                *link = item->next;
+            else
+                link = &item->next;
+        }
+        // and delete the chunks; if the bump chunk is deleted, so are all
+        // the later ones (never used), and new items will need a new chunk
+        chunk_t** chunk_link = &m_first_chunk;
+        m_last_chunk = nullptr;
+        while (chunk_t* chunk = *chunk_link) {
+            const chunk_info_t& info = find_chunk(chunk->storage);
+            if (info.free_count == info.size) {
+                if (chunk == m_bump_chunk)
+                    m_bump_chunk = nullptr;
+                *chunk_link = chunk->next;
+                delete chunk;
+                --m_chunk_count;
+            }
+            else {
+                m_last_chunk = chunk;
+                chunk_link = &chunk->next;
+            }
+        }
+        m_capacity -= released_items;
+        return released_items * sizeof(item_t);
     }
+
+    size_t bytes() const { return m_capacity * sizeof(item_t) + m_chunk_count * sizeof(chunk_t); }
 };
 
 static inline int max_i(int a, int b)
@@ -106,26 +307,321 @@ static inline int max_i(int a, int b)
     return a > b ? a : b;
 }
 
+static inline int smol_ctz64(uint64_t v)
+{
+    assert(v != 0);
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward64(&idx, v);
+    return int(idx);
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+
+static inline int smol_highest_bit(uint32_t v)
+{
+    assert(v != 0);
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanReverse(&idx, v);
+    return int(idx);
+#else
+    return 31 - __builtin_clz(v);
+#endif
+}
+
+// Finds the first shelf that has the smallest height that is at least h, and
+// has a free span of at least w. Shelf data is in "structure of arrays" form:
+// shelf heights and max free span widths. Returns -1 if there is no such shelf.
+//
+// SIMD code paths compute shelf scores (height difference, or "no fit") several
+// shelves at a time. First pass finds the minimum score, exiting early on an
+// exact height fit. Second pass finds the first shelf with that score.
+static int smol_find_best_shelf(const int* heights, const int* max_free, int count, int w, int h)
+{
+    const int k_no_fit = 0x7fffffff;
+    int i = 0;
+    int best_score = k_no_fit;
+#if SMOL_SIMD_AVX2
+    const __m256i v_h1 = _mm256_set1_epi32(h - 1);
+    const __m256i v_w1 = _mm256_set1_epi32(w - 1);
+    const __m256i v_h = _mm256_set1_epi32(h);
+    const __m256i v_no_fit = _mm256_set1_epi32(k_no_fit);
+    __m256i v_min = v_no_fit;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i hh = _mm256_loadu_si256((const __m256i*)(heights + i));
+        const __m256i ff = _mm256_loadu_si256((const __m256i*)(max_free + i));
+        const __m256i fits = _mm256_and_si256(_mm256_cmpgt_epi32(hh, v_h1), _mm256_cmpgt_epi32(ff, v_w1));
+        const __m256i score = _mm256_blendv_epi8(v_no_fit, _mm256_sub_epi32(hh, v_h), fits);
+        const int exact = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(score, _mm256_setzero_si256())));
+        if (exact)
+            return i + smol_ctz64(uint64_t(exact));
+        v_min = _mm256_min_epi32(v_min, score);
+    }
+    __m128i v_min4 = _mm_min_epi32(_mm256_castsi256_si128(v_min), _mm256_extracti128_si256(v_min, 1));
+    v_min4 = _mm_min_epi32(v_min4, _mm_shuffle_epi32(v_min4, _MM_SHUFFLE(1, 0, 3, 2)));
+    v_min4 = _mm_min_epi32(v_min4, _mm_shuffle_epi32(v_min4, _MM_SHUFFLE(2, 3, 0, 1)));
+    best_score = _mm_cvtsi128_si32(v_min4);
+#elif SMOL_SIMD_SSE2
+    const __m128i v_h1 = _mm_set1_epi32(h - 1);
+    const __m128i v_w1 = _mm_set1_epi32(w - 1);
+    const __m128i v_h = _mm_set1_epi32(h);
+    const __m128i v_no_fit = _mm_set1_epi32(k_no_fit);
+    __m128i v_min = v_no_fit;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i hh = _mm_loadu_si128((const __m128i*)(heights + i));
+        const __m128i ff = _mm_loadu_si128((const __m128i*)(max_free + i));
+        const __m128i fits = _mm_and_si128(_mm_cmpgt_epi32(hh, v_h1), _mm_cmpgt_epi32(ff, v_w1));
+        const __m128i score = _mm_or_si128(_mm_and_si128(fits, _mm_sub_epi32(hh, v_h)), _mm_andnot_si128(fits, v_no_fit));
+        const int exact = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(score, _mm_setzero_si128())));
+        if (exact)
+            return i + smol_ctz64(uint64_t(exact));
+#if defined(__SSE4_1__)
+        v_min = _mm_min_epi32(v_min, score);
+#else
+        const __m128i gt = _mm_cmpgt_epi32(v_min, score);
+        v_min = _mm_or_si128(_mm_and_si128(gt, score), _mm_andnot_si128(gt, v_min));
+#endif
+    }
+    alignas(16) int mins[4];
+    _mm_store_si128((__m128i*)mins, v_min);
+    for (int j = 0; j < 4; ++j)
+        best_score = mins[j] < best_score ? mins[j] : best_score;
+#elif SMOL_SIMD_NEON
+    const int32x4_t v_h = vdupq_n_s32(h);
+    const int32x4_t v_w = vdupq_n_s32(w);
+    const int32x4_t v_no_fit = vdupq_n_s32(k_no_fit);
+    int32x4_t v_min = v_no_fit;
+    for (; i + 4 <= count; i += 4) {
+        const int32x4_t hh = vld1q_s32(heights + i);
+        const int32x4_t ff = vld1q_s32(max_free + i);
+        const uint32x4_t fits = vandq_u32(vcgeq_s32(hh, v_h), vcgeq_s32(ff, v_w));
+        const int32x4_t score = vbslq_s32(fits, vsubq_s32(hh, v_h), v_no_fit);
+        v_min = vminq_s32(v_min, score);
+        if (vminvq_s32(score) == 0)
+            break; // exact fit within this block; second pass finds it
+    }
+    best_score = vminvq_s32(v_min);
+#endif
+
+    // remaining shelves (or all of them, without SIMD); they only win when
+    // strictly better than anything in the SIMD processed part
+    const int simd_end = i;
+    int best = -1;
+    if (best_score != 0) {
+        for (; i < count; ++i) {
+            if (heights[i] < h || max_free[i] < w)
+                continue;
+            const int score = heights[i] - h;
+            if (score < best_score) {
+                best_score = score;
+                best = i;
+                if (score == 0)
+                    break;
+            }
+        }
+    }
+    if (best >= 0 || best_score == k_no_fit)
+        return best;
+
+    // best score is within the SIMD processed part, find the first shelf that has it
+    for (i = 0; i < simd_end; ++i) {
+        if (heights[i] - h == best_score && max_free[i] >= w)
+            return i;
+    }
+    assert(false);
+    return -1;
+}
+
+// Copies a row of pixel store bytes; source and destination do not overlap.
+static void smol_copy_row(uint8_t* dst, const uint8_t* src, size_t size)
+{
+#if SMOL_SIMD_AVX2 || SMOL_SIMD_SSE2
+    if (size >= 16) {
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16)
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_loadu_si128((const __m128i*)(src + i)));
+        // remainder: last 16 bytes, overlapping the already copied ones
+        if (i < size)
+            _mm_storeu_si128((__m128i*)(dst + size - 16), _mm_loadu_si128((const __m128i*)(src + size - 16)));
+        return;
+    }
+#elif SMOL_SIMD_NEON
+    if (size >= 16) {
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16)
+            vst1q_u8(dst + i, vld1q_u8(src + i));
+        if (i < size)
+            vst1q_u8(dst + size - 16, vld1q_u8(src + size - 16));
+        return;
+    }
+#endif
+    memcpy(dst, src, size);
+}
+
+static void smol_copy_rect(uint8_t* dst, size_t dst_pitch, const uint8_t* src, size_t src_pitch, size_t row_size, int rows)
+{
+    for (int y = 0; y < rows; ++y)
+        smol_copy_row(dst + y * dst_pitch, src + y * src_pitch, row_size);
+}
+
+// Copies an image rotated by 90 degrees clockwise into a (dst_w x dst_h) rectangle;
+// source image is dst_h pixels wide and dst_w pixels tall.
+static void smol_copy_rect_rotated(uint8_t* dst, size_t dst_pitch, const uint8_t* src, size_t src_pitch, int pixel_size, int dst_w, int dst_h)
+{
+    for (int y = 0; y < dst_h; ++y) {
+        uint8_t* dst_row = dst + y * dst_pitch;
+        for (int x = 0; x < dst_w; ++x)
+            memcpy(dst_row + x * pixel_size, src + (dst_w - 1 - x) * src_pitch + y * pixel_size, pixel_size);
+    }
+}
+
+// Width size classes of slab shelf slots: widths are rounded up so that there
+// are four size classes per power of two, which wastes at most 25% of a slot.
+static constexpr int SMOL_SLAB_CLASS_COUNT = 4 + 29 * 4;
+
+static inline int smol_slab_class_index(int w)
+{
+    if (w <= 4)
+        return w - 1;
+    const uint32_t n = uint32_t(w - 1);
+    const int bit = smol_highest_bit(n);
+    return 4 + (bit - 2) * 4 + int((n >> (bit - 2)) & 3);
+}
+
+static inline int smol_slab_class_width(int w)
+{
+    if (w <= 4)
+        return w;
+    const uint32_t n = uint32_t(w - 1);
+    const uint32_t step = 1u << (smol_highest_bit(n) - 2);
+    return int((n + step) & ~(step - 1));
+}
+
+#if SMOL_ATLAS_CONCURRENT_READS
+// Copy of item rectangle for reads from other threads (see `sma_item_rect`),
+// written only by the thread that modifies the atlas. Items are copied during
+// repacks, hence the explicit copy operations.
+struct smol_published_rect_t
+{
+    smol_published_rect_t() = default;
+    smol_published_rect_t(const smol_published_rect_t& o) { store(o.load()); }
+    smol_published_rect_t& operator=(const smol_published_rect_t& o)
+    {
+        store(o.load());
+        return *this;
+    }
+
+#if SMOL_ATLAS_16BIT_COORDS
+    // whole rectangle fits into one 64 bit value: a single atomic store or load
+    void store(const smol_item_rect_t& r)
+    {
+        bits.store(uint64_t(r.x) | (uint64_t(r.y) << 16) | (uint64_t(r.width) << 32) | (uint64_t(r.height) << 48), std::memory_order_release);
+    }
+
+    smol_item_rect_t load() const
+    {
+        const uint64_t v = bits.load(std::memory_order_acquire);
+        return { int(v & 0xFFFF), int((v >> 16) & 0xFFFF), int((v >> 32) & 0xFFFF), int(v >> 48) };
+    }
+
+    std::atomic<uint64_t> bits{ 0 };
+#else
+    // 32 bit coordinates: a seqlock, sequence is odd while the rectangle is being written
+    void store(const smol_item_rect_t& r)
+    {
+        const uint32_t s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        coords[0].store(r.x, std::memory_order_relaxed);
+        coords[1].store(r.y, std::memory_order_relaxed);
+        coords[2].store(r.width, std::memory_order_relaxed);
+        coords[3].store(r.height, std::memory_order_relaxed);
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    smol_item_rect_t load() const
+    {
+        while (true) {
+            const uint32_t s = seq.load(std::memory_order_acquire);
+            const smol_item_rect_t r = { coords[0].load(std::memory_order_relaxed), coords[1].load(std::memory_order_relaxed), coords[2].load(std::memory_order_relaxed), coords[3].load(std::memory_order_relaxed) };
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (!(s & 1) && seq.load(std::memory_order_relaxed) == s)
+                return r;
+            std::this_thread::yield();
+        }
+    }
+
+    std::atomic<uint32_t> seq{ 0 };
+    std::atomic<int32_t> coords[4] = {};
+#endif
+};
+#endif
+
 struct smol_atlas_item_t
 {
     explicit smol_atlas_item_t(int x_, int y_, int w_, int h_, int shelf_)
-    : x(x_), y(y_), width(w_), height(h_), shelf_index(shelf_)
+    : x(smol_coord_t(x_)), y(smol_coord_t(y_)), width(smol_coord_t(w_)), height(smol_coord_t(h_)), shelf_index(uint32_t(shelf_)), rotated(0), in_column(0), pinned(0), live(1), user_data(0)
     {
+        publish();
     }
 
-    int x;
-    int y;
-    int width;
-    int height;
-    int shelf_index;
+    // updates the rectangle copy for reads from other threads, if those are enabled
+    void publish()
+    {
+#if SMOL_ATLAS_CONCURRENT_READS
+        published.store({ x, y, width, height });
+#endif
+    }
+
+    void unpublish()
+    {
+#if SMOL_ATLAS_CONCURRENT_READS
+        published.store({ 0, 0, 0, 0 });
+#endif
+    }
+
+    smol_coord_t x;
+    smol_coord_t y;
+    smol_coord_t width; // size within the atlas, i.e. after rotation
+    smol_coord_t height;
+    uint32_t shelf_index : 28;
+    uint32_t rotated : 1;
+    uint32_t in_column : 1; // stacked in a sub-shelf column, see smol_column_t
+    uint32_t pinned : 1; // never moved by repacks
+    uint32_t live : 1; // cleared on removal; pool free list pointer only overwrites the coordinates
+    uint64_t user_data;
+#if SMOL_ATLAS_CONCURRENT_READS
+    smol_published_rect_t published; // updated when the item moves
+#endif
 };
+static_assert(4 * sizeof(smol_coord_t) >= sizeof(void*), "smol_atlas_item_t live flag must not overlap pool free list pointer");
+// item sizes mentioned at SMOL_ATLAS_16BIT_COORDS and SMOL_ATLAS_CONCURRENT_READS
+static_assert(alignof(uint64_t) != 8 || sizeof(smol_atlas_item_t) ==
+    (SMOL_ATLAS_16BIT_COORDS ? 24 : 32) + (SMOL_ATLAS_CONCURRENT_READS ? (SMOL_ATLAS_16BIT_COORDS ? 8 : 24) : 0),
+    "smol_atlas_item_t size does not match the documented one");
+
+// Copies item pixels given in item's original orientation into its atlas rectangle.
+static void smol_copy_item_pixels(uint8_t* dst, size_t dst_pitch, const smol_atlas_item_t* item, const void* pixels, int row_pitch, int pixel_size)
+{
+    const uint8_t* src = (const uint8_t*)pixels;
+    if (item->rotated) {
+        const size_t src_row_size = size_t(item->height) * pixel_size;
+        smol_copy_rect_rotated(dst, dst_pitch, src, row_pitch > 0 ? size_t(row_pitch) : src_row_size, pixel_size, item->width, item->height);
+    }
+    else {
+        const size_t row_size = size_t(item->width) * pixel_size;
+        smol_copy_rect(dst, dst_pitch, src, row_pitch > 0 ? size_t(row_pitch) : row_size, row_size, item->height);
+    }
+}
 
 struct smol_free_span_t
 {
-    explicit smol_free_span_t(int x_, int w_) : x(x_), width(w_), next(nullptr) {}
+    explicit smol_free_span_t(int x_, int w_) : x(smol_coord_t(x_)), width(smol_coord_t(w_)), next(nullptr) {}
 
-    int x;
-    int width;
+    smol_coord_t x;
+    smol_coord_t width;
     smol_free_span_t* next;
 };
 
@@ -160,26 +656,91 @@ struct smol_single_list_t
 struct smol_shelf_t
 {
     explicit smol_shelf_t(int y, int width, int height, int index, smol_pool_t<smol_free_span_t>& span_pool)
-        : m_y(y), m_height(height), m_index(index), m_free_spans(span_pool.alloc(0, width))
+        : m_free_spans(span_pool.alloc(0, width)), m_y(y), m_width(width), m_height(height), m_index(index), m_max_free(width)
     {
     }
 
-    bool has_space_for(int width) const
+    // Slab shelves hold items of one width size class in fixed size slots,
+    // tracked by a bitmask of used slots instead of a list of free spans.
+    bool is_slab() const { return m_slot_width > 0; }
+
+    void make_slab(int slot_width, smol_pool_t<smol_free_span_t>& span_pool)
     {
+        assert(!is_slab() || m_slots_used == 0);
         smol_free_span_t* it = m_free_spans.m_head;
         while (it != nullptr) {
-            if (width <= it->width)
-                return true;
-            it = it->next;
+            smol_free_span_t* next = it->next;
+            span_pool.free(it);
+            it = next;
+        }
+        m_free_spans.m_head = nullptr;
+        m_max_free = 0;
+
+        m_slot_width = slot_width;
+        m_slot_count = m_width / slot_width;
+        m_slots_used = 0;
+        m_slot_bits.assign((m_slot_count + 63) / 64, 0);
+    }
+
+    bool is_empty() const
+    {
+        if (is_slab())
+            return m_slots_used == 0;
+        return m_free_spans.m_head != nullptr && m_free_spans.m_head->x == 0 && m_free_spans.m_head->next == nullptr && m_free_spans.m_head->width == m_width;
+    }
+
+    smol_atlas_item_t* alloc_slab_item(int w, int h, smol_pool_t<smol_atlas_item_t>& item_pool)
+    {
+        assert(is_slab() && w <= m_slot_width && h <= m_height);
+        if (m_slots_used == m_slot_count)
+            return nullptr;
+        for (size_t i = 0; i < m_slot_bits.size(); ++i) {
+            const uint64_t free_bits = ~m_slot_bits[i];
+            if (free_bits == 0)
+                continue;
+            const int slot = int(i * 64) + smol_ctz64(free_bits);
+            if (slot >= m_slot_count)
+                break;
+            m_slot_bits[i] |= uint64_t(1) << (slot & 63);
+            ++m_slots_used;
+            return item_pool.alloc(slot * m_slot_width, m_y, w, h, m_index);
         }
-        return false;
+        return nullptr;
+    }
+
+    // places an item into a given free slot; used by stable repack to keep item positions
+    smol_atlas_item_t* alloc_slab_item_at(int x, int w, int h, smol_pool_t<smol_atlas_item_t>& item_pool)
+    {
+        assert(is_slab() && w <= m_slot_width && h <= m_height);
+        const int slot = x / m_slot_width;
+        if (x != slot * m_slot_width || slot >= m_slot_count || (m_slot_bits[slot / 64] & (uint64_t(1) << (slot & 63))))
+            return nullptr;
+        m_slot_bits[slot / 64] |= uint64_t(1) << (slot & 63);
+        ++m_slots_used;
+        return item_pool.alloc(x, m_y, w, h, m_index);
+    }
+
+    void update_max_free()
+    {
+        int max_free = 0;
+        for (smol_free_span_t* it = m_free_spans.m_head; it != nullptr; it = it->next)
+            max_free = max_i(max_free, it->width);
+        m_max_free = max_free;
     }
 
     smol_atlas_item_t* alloc_item(int w, int h, smol_pool_t<smol_atlas_item_t>& item_pool, smol_pool_t<smol_free_span_t>& span_pool)
     {
         if (h > m_height)
             return nullptr;
+        const int x = alloc_span(w, span_pool);
+        if (x < 0)
+            return nullptr;
+        return item_pool.alloc(x, m_y, w, h, m_index);
+    }
 
+    // takes a range of given width from free spans; returns its X coordinate or -1
+    int alloc_span(int w, smol_pool_t<smol_free_span_t>& span_pool)
+    {
         // find a suitable free span
         smol_free_span_t* it = m_free_spans.m_head;
         smol_free_span_t* prev = nullptr;
@@ -193,10 +754,11 @@ struct smol_shelf_t
 
         // no space in this shelf
         if (it == nullptr)
-            return nullptr;
+            return -1;
 
         const int x = it->x;
         const int rest = it->width - w;
+        const bool was_max_free = it->width == m_max_free;
         if (rest > 0) {
             // there will be still space left in this span, adjust
             it->x += w;
@@ -207,10 +769,56 @@ struct smol_shelf_t
             m_free_spans.remove(prev, it);
             span_pool.free(it);
         }
+        if (was_max_free)
+            update_max_free();
+        return x;
+    }
 
+    // places an item at a given position, if that is free; used by stable repack to keep item positions
+    smol_atlas_item_t* alloc_item_at(int x, int w, int h, smol_pool_t<smol_atlas_item_t>& item_pool, smol_pool_t<smol_free_span_t>& span_pool)
+    {
+        if (h > m_height || !take_range(x, w, span_pool))
+            return nullptr;
         return item_pool.alloc(x, m_y, w, h, m_index);
     }
 
+    // takes [x, x+w) from free spans, if all of it is free
+    bool take_range(int x, int w, smol_pool_t<smol_free_span_t>& span_pool)
+    {
+        // find the free span that contains [x, x+w)
+        smol_free_span_t* it = m_free_spans.m_head;
+        smol_free_span_t* prev = nullptr;
+        while (it != nullptr && it->x + it->width < x + w) {
+            prev = it;
+            it = it->next;
+        }
+        if (it == nullptr || it->x > x)
+            return false;
+
+        const int left = x - it->x;
+        const int right = it->x + it->width - (x + w);
+        const bool was_max_free = it->width == m_max_free;
+        if (left > 0 && right > 0) {
+            // item is in the middle of the span, split it
+            it->width = smol_coord_t(left);
+            m_free_spans.insert(it, span_pool.alloc(x + w, right));
+        }
+        else if (left > 0) {
+            it->width = smol_coord_t(left);
+        }
+        else if (right > 0) {
+            it->x = smol_coord_t(x + w);
+            it->width = smol_coord_t(right);
+        }
+        else {
+            m_free_spans.remove(prev, it);
+            span_pool.free(it);
+        }
+        if (was_max_free)
+            update_max_free();
+        return true;
+    }
+
     void add_free_span(int x, int width, smol_pool_t<smol_free_span_t>& span_pool)
     {
         // insert into free spans list at the right position
@@ -231,7 +839,8 @@ struct smol_shelf_t
         if (!added)
             m_free_spans.insert(prev, free_e);
 
-        merge_free_spans(prev, free_e, span_pool);
+        smol_free_span_t* merged = merge_free_spans(prev, free_e, span_pool);
+        m_max_free = max_i(m_max_free, merged->width);
     }
 
     void free_item(smol_atlas_item_t* e, smol_pool_t<smol_atlas_item_t>& item_pool, smol_pool_t<smol_free_span_t>& span_pool)
@@ -239,11 +848,20 @@ struct smol_shelf_t
         assert(e);
         assert(e->shelf_index == m_index);
         assert(e->y == m_y);
-        add_free_span(e->x, e->width, span_pool);
+        if (is_slab()) {
+            const int slot = e->x / m_slot_width;
+            assert(m_slot_bits[slot / 64] & (uint64_t(1) << (slot & 63)));
+            m_slot_bits[slot / 64] &= ~(uint64_t(1) << (slot & 63));
+            --m_slots_used;
+        }
+        else {
+            add_free_span(e->x, e->width, span_pool);
+        }
         item_pool.free(e);
     }
 
-    void merge_free_spans(smol_free_span_t* prev, smol_free_span_t* span, smol_pool_t<smol_free_span_t>& span_pool)
+    // returns the resulting span
+    smol_free_span_t* merge_free_spans(smol_free_span_t* prev, smol_free_span_t* span, smol_pool_t<smol_free_span_t>& span_pool)
     {
         smol_free_span_t* next = span->next;
         if (next != nullptr && span->x + span->width == next->x) {
@@ -257,132 +875,1981 @@ struct smol_shelf_t
             prev->width += span->width;
             m_free_spans.remove(prev, span);
             span_pool.free(span);
+            return prev;
         }
+        return span;
     }
 
     smol_single_list_t<smol_free_span_t> m_free_spans;
     const int m_y;
+    const int m_width;
     const int m_height;
     const int m_index;
+    int m_max_free; // widest free span; zero for slab shelves
+    bool m_pinned = false; // dedicated to pinned items
+    int m_slot_width = 0;
+    int m_slot_count = 0;
+    int m_slots_used = 0;
+    std::vector<uint64_t> m_slot_bits;
 };
 
-struct smol_atlas_t
+// Sub-shelf mode: a column is an X range of a tall shelf, of full shelf height,
+// where short items are stacked on top of each other. Free vertical ranges
+// of the column are tracked as a sorted list of spans, where span "x" is the
+// offset from shelf top and "width" is the range height. When a column
+// becomes empty, its X range is given back to the shelf.
+struct smol_column_t
 {
-    explicit smol_atlas_t(int w, int h)
-        : m_item_pool(1024), m_span_pool(1024)
+    explicit smol_column_t(int shelf_index, int x, int width, int height, smol_pool_t<smol_free_span_t>& span_pool)
+        : m_free_spans(span_pool.alloc(0, height)), m_shelf_index(shelf_index), m_x(x), m_width(width), m_height(height), m_max_free(height)
     {
-        m_shelves.reserve(8);
-        m_width = w > 0 ? w : 64;
-        m_height = h > 0 ? h : 64;
     }
-    
-    ~smol_atlas_t()
+
+    bool is_empty() const
     {
-        clear();
+        return m_free_spans.m_head != nullptr && m_free_spans.m_head->next == nullptr && m_free_spans.m_head->width == m_height;
     }
 
-    smol_atlas_item_t* pack(int w, int h)
+    // takes a vertical range of given height; returns its offset or -1
+    int alloc(int h, smol_pool_t<smol_free_span_t>& span_pool)
     {
-        // find best shelf
-        smol_shelf_t* best_shelf = nullptr;
-        int best_score = 0x7fffffff;
-
-        int top_y = 0;
-        for (auto& shelf : m_shelves) {
-            const int shelf_h = shelf.m_height;
-            top_y = max_i(top_y, shelf.m_y + shelf_h);
-            
-            if (shelf_h < h)
-                continue; // too short
-            
-            if (shelf_h == h) { // exact height fit, try to use it
-                smol_atlas_item_t* res = shelf.alloc_item(w, h, m_item_pool, m_span_pool);
-                if (res != nullptr)
-                    return res;
-            }
-
-            // otherwise the shelf is too tall, track best one
-            int score = shelf_h - h;
-            if (score < best_score && shelf.has_space_for(w)) {
-                best_score = score;
-                best_shelf = &shelf;
-            }
+        smol_free_span_t* it = m_free_spans.m_head;
+        smol_free_span_t* prev = nullptr;
+        while (it != nullptr && it->width < h) {
+            prev = it;
+            it = it->next;
         }
-
-        if (best_shelf) {
-            smol_atlas_item_t* res = best_shelf->alloc_item(w, h, m_item_pool, m_span_pool);
-            if (res != nullptr)
-                return res;
+        if (it == nullptr)
+            return -1;
+        const int offset = it->x;
+        const bool was_max_free = it->width == m_max_free;
+        if (it->width > h) {
+            it->x += h;
+            it->width -= h;
         }
-
-        // no shelf with enough space: add a new shelf
-        if (w <= m_width && h <= m_height - top_y) {
-            int shelf_index = int(m_shelves.size());
-            m_shelves.emplace_back(top_y, m_width, h, shelf_index, m_span_pool);
-            return m_shelves.back().alloc_item(w, h, m_item_pool, m_span_pool);
+        else {
+            m_free_spans.remove(prev, it);
+            span_pool.free(it);
         }
-
-        // out of space
-        return nullptr;
-    }
-
-    void free_item(smol_atlas_item_t* item)
-    {
-        if (item == nullptr)
-            return;
-        assert(item->shelf_index >= 0 && item->shelf_index < m_shelves.size());
-        m_shelves[item->shelf_index].free_item(item, m_item_pool, m_span_pool);
+        if (was_max_free) {
+            m_max_free = 0;
+            for (it = m_free_spans.m_head; it != nullptr; it = it->next)
+                m_max_free = max_i(m_max_free, it->width);
+        }
+        return offset;
     }
 
-    void clear()
+    void free(int offset, int h, smol_pool_t<smol_free_span_t>& span_pool)
     {
-        m_item_pool.clear();
-        m_span_pool.clear();
-        m_shelves.clear();
+        smol_free_span_t* it = m_free_spans.m_head;
+        smol_free_span_t* prev = nullptr;
+        while (it != nullptr && it->x < offset) {
+            prev = it;
+            it = it->next;
+        }
+        smol_free_span_t* span = span_pool.alloc(offset, h);
+        m_free_spans.insert(prev, span);
+        // merge with neighbors
+        if (it != nullptr && offset + h == it->x) {
+            span->width += it->width;
+            m_free_spans.remove(span, it);
+            span_pool.free(it);
+        }
+        if (prev != nullptr && prev->x + prev->width == offset) {
+            prev->width += span->width;
+            m_free_spans.remove(prev, span);
+            span_pool.free(span);
+            span = prev;
+        }
+        m_max_free = max_i(m_max_free, span->width);
     }
 
-    smol_pool_t<smol_atlas_item_t> m_item_pool;
-    smol_pool_t<smol_free_span_t> m_span_pool;
-    std::vector<smol_shelf_t> m_shelves;
+    smol_single_list_t<smol_free_span_t> m_free_spans;
+    int m_shelf_index;
+    int m_x;
     int m_width;
     int m_height;
+    int m_max_free;
 };
 
-smol_atlas_t* sma_atlas_create(int width, int height)
-{
-    return new smol_atlas_t(width, height);
-}
-
-void sma_atlas_destroy(smol_atlas_t* atlas)
+// Skyline engine: top outline of placed items, as a list of segments sorted
+// by X that covers the whole atlas width. Items are placed at the lowest
+// position (then leftmost) where they fit, and the outline raised.
+//
+// For removal, an item whose whole top is on the outline lowers the outline
+// back to its bottom. Removed items that still have something above them are
+// kept as "holes", and are given back the same way once they become uncovered.
+// Gaps left below items when placing them are not tracked.
+struct smol_skyline_node_t
 {
-    delete atlas;
-}
+    explicit smol_skyline_node_t(int x_, int y_, int w_) : x(smol_coord_t(x_)), y(smol_coord_t(y_)), width(smol_coord_t(w_)), next(nullptr) {}
 
-int sma_atlas_width(const smol_atlas_t* atlas)
-{
-    return atlas->m_width;
-}
+    smol_coord_t x;
+    smol_coord_t y;
+    smol_coord_t width;
+    smol_skyline_node_t* next;
+};
 
-int sma_atlas_height(const smol_atlas_t* atlas)
+struct smol_skyline_hole_t
 {
-    return atlas->m_height;
-}
+    int x;
+    int y;
+    int width;
+    int height;
+};
 
-smol_atlas_item_t* sma_item_add(smol_atlas_t* atlas, int width, int height)
+struct smol_skyline_t
 {
-    return atlas->pack(width, height);
-}
+    // finds lowest position for an item; returns false if it does not fit
+    bool find(int w, int h, int atlas_w, int atlas_h, int& out_x, int& out_y) const
+    {
+        int best_x = -1;
+        int best_y = atlas_h;
+        for (const smol_skyline_node_t* node = m_nodes.m_head; node != nullptr && node->x + w <= atlas_w; node = node->next) {
+            if (node->y >= best_y)
+                continue;
+            // item would be at the highest point of segments it spans
+            int y = node->y;
+            int covered = 0;
+            for (const smol_skyline_node_t* it = node; covered < w && y < best_y; it = it->next) {
+                y = max_i(y, it->y);
+                covered += it->width;
+            }
+            if (y < best_y && y + h <= atlas_h) {
+                best_x = node->x;
+                best_y = y;
+            }
+        }
+        out_x = best_x;
+        out_y = best_y;
+        return best_x >= 0;
+    }
 
-void sma_item_remove(smol_atlas_t* atlas, smol_atlas_item_t* item)
+    // is the outline over [x, x+w) exactly at level y?
+    bool is_at(int x, int w, int y) const
+    {
+        const smol_skyline_node_t* it = m_nodes.m_head;
+        while (it != nullptr && it->x + it->width <= x)
+            it = it->next;
+        for (; it != nullptr && it->x < x + w; it = it->next) {
+            if (it->y != y)
+                return false;
+        }
+        return true;
+    }
+
+    // sets the outline over [x, x+w) to level y
+    void set(int x, int w, int y, smol_pool_t<smol_skyline_node_t>& pool)
+    {
+        smol_skyline_node_t* it = m_nodes.m_head;
+        smol_skyline_node_t* prev = nullptr;
+        while (it->x + it->width <= x) {
+            prev = it;
+            it = it->next;
+        }
+        if (it->x < x) {
+            // range starts in the middle of a segment: split it
+            smol_skyline_node_t* right = pool.alloc(x, it->y, it->x + it->width - x);
+            it->width = smol_coord_t(x - it->x);
+            m_nodes.insert(it, right);
+            prev = it;
+            it = right;
+        }
+        smol_skyline_node_t* node = pool.alloc(x, y, w);
+        m_nodes.insert(prev, node);
+        const int end = x + w;
+        while (it != nullptr && it->x < end) {
+            const int it_end = it->x + it->width;
+            if (it_end <= end) {
+                m_nodes.remove(node, it);
+                pool.free(it);
+                it = node->next;
+            }
+            else {
+                it->width = smol_coord_t(it_end - end);
+                it->x = smol_coord_t(end);
+                break;
+            }
+        }
+        // merge with neighbors of the same level
+        if (it != nullptr && it->y == node->y) {
+            node->width += it->width;
+            m_nodes.remove(node, it);
+            pool.free(it);
+        }
+        if (prev != nullptr && prev->y == node->y) {
+            prev->width += node->width;
+            m_nodes.remove(prev, node);
+            pool.free(node);
+        }
+    }
+
+    void remove(int x, int y, int w, int h, smol_pool_t<smol_skyline_node_t>& pool)
+    {
+        if (!is_at(x, w, y + h)) {
+            m_holes.push_back({ x, y, w, h });
+            return;
+        }
+        set(x, w, y, pool);
+        // lowering the outline might have uncovered some holes
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (size_t i = 0; i < m_holes.size(); ++i) {
+                const smol_skyline_hole_t hole = m_holes[i];
+                if (is_at(hole.x, hole.width, hole.y + hole.height)) {
+                    set(hole.x, hole.width, hole.y, pool);
+                    m_holes[i] = m_holes.back();
+                    m_holes.pop_back();
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    smol_single_list_t<smol_skyline_node_t> m_nodes{ nullptr };
+    std::vector<smol_skyline_hole_t> m_holes;
+};
+
+struct smol_slab_class_t
+{
+    int live = 0; // live item count of this size class
+    int free_shelf = -1; // slab shelf that last had a free slot for this class
+};
+
+// vertical range of atlas that has no shelves, below the topmost shelf
+struct smol_free_row_t
+{
+    int y;
+    int height;
+};
+
+// shelf layout snapshot for stable repack
+struct smol_repack_shelf_t
+{
+    int y;
+    int height;
+    int slot_width;
+    bool pinned;
+};
+
+// item pixels pushed for a batched upload
+struct smol_upload_item_t
+{
+    const smol_atlas_item_t* item;
+    size_t offset; // in pushed pixels buffer
+};
+
+static constexpr int SMOL_REPACK_ORDERING_COUNT = 4;
+
+struct smol_atlas_t
+{
+    explicit smol_atlas_t(int w, int h, int flags)
+        : m_item_pool(1024), m_span_pool(1024), m_skyline_pool((flags & SMA_ATLAS_SKYLINE) ? 1024 : 1), m_flags(flags)
+    {
+        m_shelves.reserve(8);
+        set_size(w > 0 ? w : 64, h > 0 ? h : 64);
+        if (m_flags & SMA_ATLAS_SLABS)
+            m_slab_classes.assign(SMOL_SLAB_CLASS_COUNT, smol_slab_class_t());
+    }
+    
+    ~smol_atlas_t()
+    {
+        if (m_async_active)
+            m_async_thread.join();
+        clear();
+        delete m_repack_scratch;
+    }
+
+    smol_atlas_item_t* pack(int w, int h, bool allow_rotate = false)
+    {
+        smol_atlas_item_t* res;
+        if (m_flags & SMA_ATLAS_SKYLINE) {
+            res = pack_skyline(w, h);
+        }
+        else if (m_flags & SMA_ATLAS_SLABS) {
+            smol_slab_class_t& cls = m_slab_classes[smol_slab_class_index(w)];
+            res = pack_slab(w, h, cls);
+            if (res != nullptr)
+                ++cls.live;
+        }
+        else {
+            res = pack_shelf(w, h, allow_rotate);
+        }
+        if (m_async_active && res != nullptr)
+            m_async_added.push_back(res);
+        return res;
+    }
+
+    smol_atlas_item_t* pack_shelf(int w, int h, bool allow_rotate = false)
+    {
+        // find best shelf: exact height fit, or otherwise the one that wastes least height
+        int best = smol_find_best_shelf(m_shelf_heights.data(), m_shelf_max_free.data(), int(m_shelves.size()), w, h);
+        bool rotated = false;
+        if (allow_rotate && w != h) {
+            // also consider the item rotated, and pick the orientation that wastes less height;
+            // if neither fits any shelf, lying down makes a new shelf less tall
+            const int best_rot = smol_find_best_shelf(m_shelf_heights.data(), m_shelf_max_free.data(), int(m_shelves.size()), h, w);
+            if (best_rot >= 0)
+                rotated = best < 0 || m_shelf_heights[best_rot] - w < m_shelf_heights[best] - h;
+            else if (best < 0)
+                rotated = h <= m_width && (h > w || w > m_width);
+            if (rotated) {
+                best = best_rot;
+                std::swap(w, h);
+            }
+        }
+        if (m_flags & SMA_ATLAS_SUBSHELVES) {
+            smol_atlas_item_t* res = pack_column(w, h, best);
+            if (res != nullptr) {
+                res->rotated = rotated;
+                return res;
+            }
+        }
+        smol_shelf_t* shelf = nullptr;
+        if (best >= 0) {
+            shelf = &m_shelves[best];
+        }
+        else if (w <= m_width) {
+            // no shelf with enough space: add a new shelf
+            shelf = add_shelf(h);
+        }
+        if (shelf == nullptr)
+            return nullptr; // out of space
+
+        smol_atlas_item_t* res = shelf->alloc_item(w, h, m_item_pool, m_span_pool);
+        assert(res);
+        res->rotated = rotated;
+        update_shelf_max_free(*shelf);
+        return res;
+    }
+
+    smol_atlas_item_t* pack_skyline(int w, int h)
+    {
+        if (m_skyline.m_nodes.m_head == nullptr)
+            m_skyline.m_nodes.m_head = m_skyline_pool.alloc(0, 0, m_width);
+        int x, y;
+        if (!m_skyline.find(w, h, m_width, m_height, x, y))
+            return nullptr;
+        m_skyline.set(x, w, y + h, m_skyline_pool);
+        m_top_y = max_i(m_top_y, y + h);
+        return m_item_pool.alloc(x, y, w, h, 0);
+    }
+
+    // Sub-shelf mode: puts a short item into a column of a taller shelf, when that
+    // wastes less space than putting it into the best shelf directly. A new column
+    // is started in the best shelf if the item is at most half as tall as the shelf.
+    smol_atlas_item_t* pack_column(int w, int h, int best)
+    {
+        const int64_t shelf_waste = best >= 0 ? int64_t(m_shelf_heights[best] - h) * w : INT64_MAX;
+        if (shelf_waste == 0)
+            return nullptr;
+        int best_col = -1;
+        int64_t best_waste = shelf_waste;
+        for (int i = 0; i < int(m_columns.size()); ++i) {
+            const smol_column_t& col = m_columns[i];
+            if (col.m_width < w || col.m_max_free < h)
+                continue;
+            const int64_t waste = int64_t(col.m_width - w) * h;
+            if (waste < best_waste) {
+                best_waste = waste;
+                best_col = i;
+                if (waste == 0)
+                    break;
+            }
+        }
+        if (best_col < 0) {
+            if (best < 0 || m_shelf_heights[best] < 2 * h)
+                return nullptr;
+            smol_shelf_t& shelf = m_shelves[best];
+            const int x = shelf.alloc_span(w, m_span_pool);
+            assert(x >= 0);
+            update_shelf_max_free(shelf);
+            best_col = int(m_columns.size());
+            m_columns.emplace_back(best, x, w, shelf.m_height, m_span_pool);
+        }
+        smol_column_t& col = m_columns[best_col];
+        const int offset = col.alloc(h, m_span_pool);
+        assert(offset >= 0);
+        smol_atlas_item_t* res = m_item_pool.alloc(col.m_x, m_shelves[col.m_shelf_index].m_y + offset, w, h, col.m_shelf_index);
+        res->in_column = 1;
+        return res;
+    }
+
+    void free_column_item(smol_atlas_item_t* item, smol_shelf_t& shelf)
+    {
+        for (size_t i = 0; i < m_columns.size(); ++i) {
+            smol_column_t& col = m_columns[i];
+            if (col.m_shelf_index != int(item->shelf_index) || col.m_x != item->x)
+                continue;
+            col.free(item->y - shelf.m_y, item->height, m_span_pool);
+            if (col.is_empty()) {
+                // whole column is free: give it back to the shelf
+                m_span_pool.free(col.m_free_spans.m_head);
+                shelf.add_free_span(col.m_x, col.m_width, m_span_pool);
+                m_columns[i] = m_columns.back();
+                m_columns.pop_back();
+            }
+            break;
+        }
+        m_item_pool.free(item);
+    }
+
+    // Slab mode: items go into slab shelves of their width size class when
+    // there are any with free slots. Slab shelves for a size class are only created
+    // once it has enough live items to fill a good part of a shelf; rarely
+    // seen sizes go into regular shelves.
+    smol_atlas_item_t* pack_slab(int w, int h, smol_slab_class_t& cls)
+    {
+        const int slot_w = smol_slab_class_width(w) <= m_width ? smol_slab_class_width(w) : w;
+
+        // shelf that last had an item of this size class removed is
+        // very likely an exact fit with a free slot
+        if (cls.free_shelf >= 0) {
+            smol_shelf_t& shelf = m_shelves[cls.free_shelf];
+            if (shelf.m_height == h && shelf.m_slot_width == slot_w && shelf.m_slots_used < shelf.m_slot_count && !shelf.m_pinned)
+                return shelf.alloc_slab_item(w, h, m_item_pool);
+        }
+
+        // find best slab shelf of this size class; pinned shelves are only for pinned items
+        smol_shelf_t* best_shelf = nullptr;
+        int best_score = 0x7fffffff;
+        for (auto& shelf : m_shelves) {
+            const int shelf_h = shelf.m_height;
+            if (shelf_h < h || shelf.m_slot_width != slot_w || shelf.m_slots_used == shelf.m_slot_count || shelf.m_pinned)
+                continue;
+            int score = shelf_h - h;
+            if (score == 0) {
+                cls.free_shelf = shelf.m_index;
+                return shelf.alloc_slab_item(w, h, m_item_pool); // exact fit
+            }
+            if (score < best_score) {
+                best_score = score;
+                best_shelf = &shelf;
+            }
+        }
+        if (best_shelf != nullptr)
+            return best_shelf->alloc_slab_item(w, h, m_item_pool);
+
+        // is this size class common enough to get a new slab?
+        const int slots_per_shelf = m_width / slot_w;
+        if (slots_per_shelf > 1 && cls.live + 1 >= slots_per_shelf) {
+            // use an empty shelf of exactly this height, or make a new one
+            smol_shelf_t* shelf = nullptr;
+            for (auto& it : m_shelves) {
+                if (it.m_height == h && it.is_empty() && !it.m_pinned) {
+                    shelf = &it;
+                    break;
+                }
+            }
+            if (shelf == nullptr)
+                shelf = add_shelf(h);
+            if (shelf != nullptr) {
+                shelf->make_slab(slot_w, m_span_pool);
+                m_shelf_max_free[shelf->m_index] = 0;
+                cls.free_shelf = shelf->m_index;
+                return shelf->alloc_slab_item(w, h, m_item_pool);
+            }
+        }
+
+        return pack_shelf(w, h);
+    }
+
+    smol_atlas_item_t* add_pinned(int w, int h)
+    {
+        if (m_flags & SMA_ATLAS_SKYLINE)
+            return nullptr;
+        smol_atlas_item_t* res = pack_pinned(w, h);
+        if (m_async_active && res != nullptr)
+            m_async_added.push_back(res);
+        return res;
+    }
+
+    bool set_pinned(smol_atlas_item_t* item, bool pinned)
+    {
+        if (pinned == (item->pinned != 0))
+            return true;
+        if (pinned && ((m_flags & SMA_ATLAS_SKYLINE) || item->in_column))
+            return false;
+        item->pinned = pinned;
+        m_pinned_count += pinned ? 1 : -1;
+        return true;
+    }
+
+    // Resizes in place when possible: shrinking gives the rest back to the shelf,
+    // growing takes the free space right after the item. Otherwise the item is
+    // placed anew, and its old space freed; the new placement gets allocated
+    // into a temporary item, whose placement is then swapped with this one, so
+    // that the item pointer stays the same.
+    bool resize_item(smol_atlas_item_t* item, int w, int h, bool& moved)
+    {
+        moved = false;
+        if (m_async_active || w <= 0 || h <= 0)
+            return false;
+        // in atlas orientation
+        const int aw = item->rotated ? h : w;
+        const int ah = item->rotated ? w : h;
+        if (aw == item->width && ah == item->height)
+            return true;
+        if (!(m_flags & SMA_ATLAS_SKYLINE) && !item->in_column) {
+            smol_shelf_t& shelf = m_shelves[item->shelf_index];
+            bool in_place = false;
+            if (ah <= shelf.m_height) {
+                if (shelf.is_slab()) {
+                    in_place = aw <= shelf.m_slot_width && smol_slab_class_index(aw) == smol_slab_class_index(item->width);
+                }
+                else if (aw <= item->width) {
+                    if (aw < item->width)
+                        shelf.add_free_span(item->x + aw, item->width - aw, m_span_pool);
+                    in_place = true;
+                }
+                else {
+                    in_place = shelf.take_range(item->x + item->width, aw - item->width, m_span_pool);
+                }
+            }
+            if (in_place) {
+                if ((m_flags & SMA_ATLAS_SLABS) && smol_slab_class_index(aw) != smol_slab_class_index(item->width)) {
+                    --m_slab_classes[smol_slab_class_index(item->width)].live;
+                    ++m_slab_classes[smol_slab_class_index(aw)].live;
+                }
+                item->width = smol_coord_t(aw);
+                item->height = smol_coord_t(ah);
+                update_shelf_max_free(shelf);
+                item->publish();
+                return true;
+            }
+        }
+
+        smol_atlas_item_t* res;
+        if (item->pinned) {
+            res = pack_pinned(aw, ah);
+            if (res != nullptr)
+                res->rotated = item->rotated;
+        }
+        else {
+            res = pack(w, h, (m_flags & (SMA_ATLAS_ROTATE | SMA_ATLAS_SLABS)) == SMA_ATLAS_ROTATE);
+        }
+        if (res == nullptr)
+            return false;
+        const smol_atlas_item_t old = *item;
+        item->x = res->x;
+        item->y = res->y;
+        item->width = res->width;
+        item->height = res->height;
+        item->shelf_index = res->shelf_index;
+        item->rotated = res->rotated;
+        item->in_column = res->in_column;
+        res->x = old.x;
+        res->y = old.y;
+        res->width = old.width;
+        res->height = old.height;
+        res->shelf_index = old.shelf_index;
+        res->rotated = old.rotated;
+        res->in_column = old.in_column;
+        free_item(res);
+        item->publish();
+        moved = true;
+        return true;
+    }
+
+    // Shelf search skips pinned shelves: their widest free span is zero in
+    // the search table.
+    void update_shelf_max_free(const smol_shelf_t& shelf)
+    {
+        m_shelf_max_free[shelf.m_index] = shelf.m_pinned ? 0 : shelf.m_max_free;
+    }
+
+    smol_shelf_t* make_pinned(smol_shelf_t* shelf)
+    {
+        shelf->m_pinned = true;
+        update_shelf_max_free(*shelf);
+        m_pinned_shelves.push_back(shelf->m_index);
+        return shelf;
+    }
+
+    // Pinned items go to their own shelves (best height fit among them), so that
+    // they do not keep other shelves from being compacted by repacks.
+    smol_atlas_item_t* pack_pinned(int w, int h)
+    {
+        smol_shelf_t* best = nullptr;
+        for (int index : m_pinned_shelves) {
+            smol_shelf_t& shelf = m_shelves[index];
+            if (shelf.m_height < h || shelf.m_max_free < w)
+                continue;
+            if (best == nullptr || shelf.m_height < best->m_height)
+                best = &shelf;
+            if (shelf.m_height == h)
+                break;
+        }
+        if (best == nullptr && w <= m_width) {
+            best = add_shelf(h);
+            if (best != nullptr)
+                make_pinned(best);
+        }
+        if (best == nullptr)
+            return nullptr;
+        smol_atlas_item_t* res = best->alloc_item(w, h, m_item_pool, m_span_pool);
+        assert(res);
+        res->pinned = 1;
+        ++m_pinned_count;
+        if (m_flags & SMA_ATLAS_SLABS)
+            ++m_slab_classes[smol_slab_class_index(w)].live;
+        update_shelf_max_free(*best);
+        return res;
+    }
+
+    smol_shelf_t* add_shelf(int h)
+    {
+        // free rows between shelves only exist after a stable repack;
+        // use the best fitting one if any
+        int best = -1;
+        for (int i = 0; i < int(m_free_rows.size()); ++i) {
+            if (m_free_rows[i].height >= h && (best < 0 || m_free_rows[i].height < m_free_rows[best].height))
+                best = i;
+        }
+        if (best >= 0) {
+            smol_free_row_t& row = m_free_rows[best];
+            const int y = row.y;
+            row.y += h;
+            row.height -= h;
+            if (row.height == 0)
+                m_free_rows.erase(m_free_rows.begin() + best);
+            return add_shelf_at(y, h);
+        }
+
+        if (h > m_height - m_top_y)
+            return nullptr;
+        return add_shelf_at(m_top_y, h);
+    }
+
+    smol_shelf_t* add_shelf_at(int y, int h)
+    {
+        int shelf_index = int(m_shelves.size());
+        m_shelves.emplace_back(y, m_width, h, shelf_index, m_span_pool);
+        m_shelf_heights.push_back(h);
+        m_shelf_max_free.push_back(m_width);
+        m_top_y = max_i(m_top_y, y + h);
+        return &m_shelves.back();
+    }
+
+    // places an item at a given position on a given shelf, if that is free
+    smol_atlas_item_t* place_item(int shelf_index, int x, int w, int h)
+    {
+        smol_shelf_t& shelf = m_shelves[shelf_index];
+        smol_atlas_item_t* res;
+        if (shelf.is_slab())
+            res = w <= shelf.m_slot_width ? shelf.alloc_slab_item_at(x, w, h, m_item_pool) : nullptr;
+        else
+            res = shelf.alloc_item_at(x, w, h, m_item_pool, m_span_pool);
+        if (res != nullptr && (m_flags & SMA_ATLAS_SLABS))
+            ++m_slab_classes[smol_slab_class_index(w)].live;
+        update_shelf_max_free(shelf);
+        return res;
+    }
+
+    void free_item(smol_atlas_item_t* item)
+    {
+        if (item == nullptr)
+            return;
+        item->live = 0;
+        item->unpublish();
+        if (item->pinned)
+            --m_pinned_count;
+        if (m_async_active) {
+            // removing an item added during async repack: just forget about it,
+            // otherwise remember that it was removed
+            auto it = std::find(m_async_added.begin(), m_async_added.end(), item);
+            if (it != m_async_added.end()) {
+                *it = m_async_added.back();
+                m_async_added.pop_back();
+            }
+            else {
+                m_async_removed.push_back(item);
+            }
+        }
+        if (m_flags & SMA_ATLAS_SKYLINE) {
+            m_skyline.remove(item->x, item->y, item->width, item->height, m_skyline_pool);
+            m_item_pool.free(item);
+            return;
+        }
+        assert(item->shelf_index >= 0 && item->shelf_index < m_shelves.size());
+        if (m_flags & SMA_ATLAS_SLABS) {
+            smol_slab_class_t& cls = m_slab_classes[smol_slab_class_index(item->width)];
+            --cls.live;
+            if (m_shelves[item->shelf_index].is_slab())
+                cls.free_shelf = item->shelf_index;
+        }
+        smol_shelf_t& shelf = m_shelves[item->shelf_index];
+        if (item->in_column)
+            free_column_item(item, shelf);
+        else
+            shelf.free_item(item, m_item_pool, m_span_pool);
+        update_shelf_max_free(shelf);
+    }
+
+    void clear()
+    {
+        if (m_async_active) {
+            // clearing cancels async repack
+            m_async_thread.join();
+            m_async_active = false;
+            m_repack_scratch->clear();
+        }
+        m_item_pool.clear();
+        m_span_pool.clear();
+        m_skyline_pool.clear();
+        m_skyline.m_nodes.m_head = nullptr; // created on first use, for current atlas width
+        m_skyline.m_holes.clear();
+        m_shelves.clear();
+        m_shelf_heights.clear();
+        m_shelf_max_free.clear();
+        m_free_rows.clear();
+        m_columns.clear();
+        m_pinned_shelves.clear();
+        m_pinned_count = 0;
+        m_top_y = 0;
+        if (m_flags & SMA_ATLAS_SLABS)
+            m_slab_classes.assign(SMOL_SLAB_CLASS_COUNT, smol_slab_class_t());
+    }
+
+    template <typename F> void for_each_item(F func)
+    {
+        m_item_pool.for_each_slot([&](smol_atlas_item_t* item) {
+            if (item->live)
+                func(item);
+        });
+    }
+
+    void reserve(int items, int spans, int shelves)
+    {
+        m_item_pool.reserve(std::max(items, 0));
+        // skyline nodes take the role of free spans
+        if (m_flags & SMA_ATLAS_SKYLINE)
+            m_skyline_pool.reserve(std::max(spans, 0));
+        else
+            m_span_pool.reserve(std::max(spans, 0));
+        if (shelves > 0) {
+            m_shelves.reserve(shelves);
+            m_shelf_heights.reserve(shelves);
+            m_shelf_max_free.reserve(shelves);
+        }
+    }
+
+    // Creates empty shelves of given heights up front, tallest ones first.
+    // Returns the number of shelves created.
+    int prewarm_shelves(const int* heights, const int* counts, int count)
+    {
+        if (m_flags & SMA_ATLAS_SKYLINE)
+            return 0;
+        std::vector<std::pair<int, int>> order; // height, count
+        int total = 0;
+        for (int i = 0; i < count; ++i) {
+            if (heights[i] > 0 && counts[i] > 0) {
+                order.push_back({ heights[i], counts[i] });
+                total += counts[i];
+            }
+        }
+        std::stable_sort(order.begin(), order.end(), [](const std::pair<int, int>& a, const std::pair<int, int>& b) { return a.first > b.first; });
+        reserve(0, int(m_shelves.size()) + total, int(m_shelves.size()) + total);
+
+        int created = 0;
+        for (const auto& hc : order) {
+            for (int i = 0; i < hc.second; ++i) {
+                if (add_shelf(hc.first) == nullptr)
+                    break;
+                ++created;
+            }
+        }
+        return created;
+    }
+
+    size_t trim()
+    {
+        size_t released = m_item_pool.trim() + m_span_pool.trim() + m_skyline_pool.trim();
+        // scratch atlas is only needed during repacks, it gets created again when needed
+        if (m_repack_scratch != nullptr && !m_async_active) {
+            released += m_repack_scratch->m_item_pool.bytes() + m_repack_scratch->m_span_pool.bytes() + m_repack_scratch->m_skyline_pool.bytes();
+            delete m_repack_scratch;
+            m_repack_scratch = nullptr;
+        }
+        return released;
+    }
+
+    // Repacking is done by packing a snapshot of item sizes into a scratch atlas
+    // (so that on failure, current layout is kept intact), and then taking the
+    // layout from there. Items keep their identity; only their positions change.
+    //
+    // Async repack does the scratch atlas packing on a worker thread, while this
+    // atlas keeps on serving additions and removals. Those are recorded, and
+    // reconciled with the new layout when it is taken.
+    bool repack(smol_atlas_item_t** items, int count, int flags, int new_w, int new_h)
+    {
+        if (m_async_active)
+            return false;
+        repack_snapshot(items, count, flags, new_w, new_h);
+        if (!repack_build(flags)) {
+            m_repack_scratch->clear();
+            return false;
+        }
+        repack_apply(0);
+        return true;
+    }
+
+    bool repack_async_begin(smol_atlas_item_t** items, int count, int flags, int new_w, int new_h)
+    {
+        if (m_async_active)
+            return false;
+        repack_snapshot(items, count, flags, new_w, new_h);
+        m_async_added.clear();
+        m_async_removed.clear();
+        m_async_active = true;
+        m_async_done.store(false);
+        m_async_thread = std::thread([this, flags]() {
+            m_async_ok = repack_build(flags);
+            m_async_done.store(true, std::memory_order_release);
+        });
+        return true;
+    }
+
+    int repack_async_finish()
+    {
+        if (!m_async_active)
+            return -1;
+        m_async_thread.join();
+        m_async_active = false;
+        smol_atlas_t& scratch = *m_repack_scratch;
+        if (!m_async_ok) {
+            scratch.clear();
+            return -1;
+        }
+
+        // items removed since the snapshot: remove them from new layout too
+        std::sort(m_async_removed.begin(), m_async_removed.end());
+        for (size_t i = 0; i < m_repack_order.size(); ++i) {
+            smol_atlas_item_t*& item = m_repack_items[m_repack_order[i]];
+            if (std::binary_search(m_async_removed.begin(), m_async_removed.end(), item)) {
+                scratch.free_item(m_repack_results[i]);
+                item = nullptr;
+            }
+        }
+        // items added since the snapshot: add them to new layout
+        const size_t added_count = m_async_added.size();
+        for (size_t i = 0; i < added_count; ++i) {
+            smol_atlas_item_t* item = m_async_added[i];
+            smol_atlas_item_t* res = item->pinned ? scratch.pack_pinned(item->width, item->height) : scratch.pack(item->width, item->height);
+            if (res == nullptr) {
+                scratch.clear();
+                return -1;
+            }
+            m_repack_order.push_back(int(m_repack_items.size()));
+            m_repack_items.push_back(item);
+            m_repack_results.push_back(res);
+        }
+        repack_apply(added_count);
+        return int(m_repack_moves.size());
+    }
+
+    void repack_snapshot(smol_atlas_item_t** items, int count, int flags, int new_w, int new_h)
+    {
+        if (m_repack_scratch == nullptr)
+            m_repack_scratch = new smol_atlas_t(new_w, new_h, m_flags);
+        m_repack_scratch->set_size(new_w, new_h);
+        m_repack_items.assign(items, items + count);
+        m_repack_sizes.resize(count);
+        for (int i = 0; i < count; ++i)
+            m_repack_sizes[i] = { items[i]->width, items[i]->height };
+
+        // stable repack, or keeping pinned items in place, also needs
+        // current positions and shelves
+        m_repack_places.clear();
+        m_repack_shelves.clear();
+        m_repack_pinned = m_pinned_count > 0;
+        if (((flags & SMA_REPACK_STABLE) || m_repack_pinned) && !(m_flags & SMA_ATLAS_SKYLINE)) {
+            for (int i = 0; i < count; ++i)
+                m_repack_places.push_back(*items[i]);
+            for (const smol_shelf_t& shelf : m_shelves)
+                m_repack_shelves.push_back({ shelf.m_y, shelf.m_height, shelf.m_slot_width, shelf.m_pinned });
+        }
+    }
+
+    // Packs item size snapshot into the scratch atlas, possibly trying several
+    // orderings. Only touches the scratch atlas and repack state; this can run
+    // on a separate thread.
+    bool repack_build(int flags)
+    {
+        const int count = int(m_repack_sizes.size());
+        m_repack_order.resize(count);
+        m_repack_results.resize(count);
+        if ((flags & SMA_REPACK_STABLE) && !(m_flags & SMA_ATLAS_SKYLINE))
+            return repack_stable();
+        const int ordering_count = (flags & SMA_REPACK_TRY_ORDERINGS) ? SMOL_REPACK_ORDERING_COUNT : 1;
+        int best_ordering = -1;
+        int best_height = 0x7fffffff;
+        for (int ordering = 0; ordering < ordering_count; ++ordering) {
+            int height = repack_into_scratch(ordering);
+            if (height >= 0 && height < best_height) {
+                best_height = height;
+                best_ordering = ordering;
+            }
+        }
+        if (best_ordering < 0)
+            return false;
+        if (best_ordering != ordering_count - 1)
+            repack_into_scratch(best_ordering);
+        return true;
+    }
+
+    // Packs the item sizes into the scratch atlas in the given ordering. Returns
+    // used atlas height, or -1 if they do not fit.
+    int repack_into_scratch(int ordering)
+    {
+        const int count = int(m_repack_sizes.size());
+        const smol_item_size_t* sizes = m_repack_sizes.data();
+        smol_atlas_t& scratch = *m_repack_scratch;
+        scratch.clear();
+        int kept = 0;
+        if (m_repack_pinned) {
+            kept = repack_keep_shelves(false);
+            if (kept < 0)
+                return -1;
+        }
+        else {
+            for (int i = 0; i < count; ++i)
+                m_repack_order[i] = i;
+        }
+        std::sort(m_repack_order.begin() + kept, m_repack_order.end(), [&](int ia, int ib) {
+            const smol_item_size_t& a = sizes[ia];
+            const smol_item_size_t& b = sizes[ib];
+            int ka = 0, kb = 0, ka2 = 0, kb2 = 0;
+            switch (ordering) {
+            case 0: ka = a.height; kb = b.height; ka2 = a.width; kb2 = b.width; break; // height, then width
+            case 1: ka = a.width; kb = b.width; ka2 = a.height; kb2 = b.height; break; // width, then height
+            case 2: ka = a.width * a.height; kb = b.width * b.height; ka2 = a.height; kb2 = b.height; break; // area
+            default: ka = max_i(a.width, a.height); kb = max_i(b.width, b.height); ka2 = a.height; kb2 = b.height; break; // longer side
+            }
+            if (ka != kb) return ka > kb;
+            if (ka2 != kb2) return ka2 > kb2;
+            return ia < ib;
+        });
+
+        for (int i = kept; i < count; ++i) {
+            const smol_item_size_t& size = sizes[m_repack_order[i]];
+            smol_atlas_item_t* res = scratch.pack(size.width, size.height);
+            if (res == nullptr)
+                return -1;
+            m_repack_results[i] = res;
+        }
+        return scratch.m_top_y;
+    }
+
+    // Stable repack: items stay where they are, on shelves that are at least
+    // half full and still fit into the atlas. Items of sparsely used shelves are
+    // moved into free space of the kept shelves, or into new shelves placed in
+    // the vertical space left by the dropped ones.
+    bool repack_stable()
+    {
+        const int count = int(m_repack_places.size());
+        smol_atlas_t& scratch = *m_repack_scratch;
+        scratch.clear();
+        const int kept = repack_keep_shelves(true);
+        if (kept < 0)
+            return false;
+
+        // pack moved items, by decreasing height then width
+        const smol_item_size_t* sizes = m_repack_sizes.data();
+        std::sort(m_repack_order.begin() + kept, m_repack_order.end(), [&](int ia, int ib) {
+            const smol_item_size_t& a = sizes[ia];
+            const smol_item_size_t& b = sizes[ib];
+            if (a.height != b.height) return a.height > b.height;
+            if (a.width != b.width) return a.width > b.width;
+            return ia < ib;
+        });
+        for (int i = kept; i < count; ++i) {
+            const smol_item_size_t& size = sizes[m_repack_order[i]];
+            smol_atlas_item_t* res = scratch.pack(size.width, size.height);
+            if (res == nullptr)
+                return false;
+            m_repack_results[i] = res;
+        }
+        return true;
+    }
+
+    // Recreates shelves that stay in place in the (cleared) scratch atlas, and places
+    // items on them. Shelves with pinned items always stay; in a stable repack, also
+    // the ones that are at least half full and fit into the atlas. In a stable repack
+    // all items of kept shelves stay in place, otherwise only the pinned ones.
+    // Placed items go first in the repack order, the rest after them. Returns the
+    // number of placed items, or -1 if pinned items do not fit into the atlas.
+    int repack_keep_shelves(bool stable)
+    {
+        const int count = int(m_repack_places.size());
+        const int shelf_count = int(m_repack_shelves.size());
+        smol_atlas_t& scratch = *m_repack_scratch;
+
+        // used width of each shelf (negative if it has pinned items);
+        // then which shelves are kept, in Y order
+        m_repack_shelf_map.assign(shelf_count, 0);
+        for (const smol_atlas_item_t& item : m_repack_places) {
+            int& used = m_repack_shelf_map[item.shelf_index];
+            if (item.pinned)
+                used = INT32_MIN;
+            else
+                used += item.width;
+        }
+        m_repack_shelf_order.clear();
+        const int width = std::min(m_width, scratch.m_width);
+        for (int i = 0; i < shelf_count; ++i) {
+            const smol_repack_shelf_t& shelf = m_repack_shelves[i];
+            const int used = m_repack_shelf_map[i];
+            m_repack_shelf_map[i] = -1;
+            const bool fits = shelf.y + shelf.height <= scratch.m_height;
+            if (used < 0 && !fits)
+                return -1;
+            if (used < 0 || (stable && used > 0 && used * 2 >= width && fits))
+                m_repack_shelf_order.push_back(i);
+        }
+        std::sort(m_repack_shelf_order.begin(), m_repack_shelf_order.end(), [&](int a, int b) {
+            return m_repack_shelves[a].y < m_repack_shelves[b].y;
+        });
+
+        // recreate kept shelves at the same positions; space between them becomes free rows
+        for (int idx : m_repack_shelf_order) {
+            const smol_repack_shelf_t& src = m_repack_shelves[idx];
+            if (src.y > scratch.m_top_y)
+                scratch.m_free_rows.push_back({ scratch.m_top_y, src.y - scratch.m_top_y });
+            smol_shelf_t* shelf = scratch.add_shelf_at(src.y, src.height);
+            if (src.slot_width > 0 && src.slot_width <= scratch.m_width) {
+                shelf->make_slab(src.slot_width, scratch.m_span_pool);
+                scratch.m_shelf_max_free[shelf->m_index] = 0;
+            }
+            if (src.pinned)
+                scratch.make_pinned(shelf);
+            m_repack_shelf_map[idx] = shelf->m_index;
+        }
+
+        // keep items of kept shelves in place; the rest go to the end of the order
+        int kept = 0;
+        for (int i = 0; i < count; ++i) {
+            const smol_atlas_item_t& item = m_repack_places[i];
+            const int shelf = m_repack_shelf_map[item.shelf_index];
+            smol_atlas_item_t* res = nullptr;
+            if (shelf >= 0 && (stable || item.pinned) && !item.in_column && item.x + item.width <= scratch.m_width)
+                res = scratch.place_item(shelf, item.x, item.width, item.height);
+            if (res != nullptr) {
+                m_repack_order[kept] = i;
+                m_repack_results[kept] = res;
+                ++kept;
+            }
+            else if (item.pinned) {
+                return -1;
+            }
+            else {
+                m_repack_order[count - 1 - (i - kept)] = i;
+            }
+        }
+        return kept;
+    }
+
+    // Takes the new layout from scratch atlas: item positions, shelves and free spans.
+    // Records which items have moved. Last `added_count` items were not in the
+    // layout before; they count as moved too.
+    void repack_apply(size_t added_count)
+    {
+        smol_atlas_t& scratch = *m_repack_scratch;
+        m_repack_moves.clear();
+        // odd epoch while the moved item rectangles are being published
+        const uint32_t epoch = m_epoch.load(std::memory_order_relaxed);
+        m_epoch.store(epoch + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        const size_t count = m_repack_order.size();
+        for (size_t i = 0; i < count; ++i) {
+            smol_atlas_item_t* dst = m_repack_items[m_repack_order[i]];
+            if (dst == nullptr)
+                continue;
+            const smol_atlas_item_t* src = m_repack_results[i];
+            const bool moved = dst->x != src->x || dst->y != src->y;
+            if (moved || i >= count - added_count)
+                m_repack_moves.push_back({ dst, dst->x, dst->y });
+            dst->x = src->x;
+            dst->y = src->y;
+            dst->shelf_index = src->shelf_index;
+            dst->in_column = src->in_column;
+            if (moved)
+                dst->publish();
+        }
+        m_epoch.store(epoch + 2, std::memory_order_release);
+        m_span_pool.swap(scratch.m_span_pool);
+        m_skyline_pool.swap(scratch.m_skyline_pool);
+        std::swap(m_skyline.m_nodes.m_head, scratch.m_skyline.m_nodes.m_head);
+        m_skyline.m_holes.swap(scratch.m_skyline.m_holes);
+        m_shelves.swap(scratch.m_shelves);
+        m_shelf_heights.swap(scratch.m_shelf_heights);
+        m_shelf_max_free.swap(scratch.m_shelf_max_free);
+        m_slab_classes.swap(scratch.m_slab_classes);
+        m_free_rows.swap(scratch.m_free_rows);
+        m_columns.swap(scratch.m_columns);
+        m_pinned_shelves.swap(scratch.m_pinned_shelves);
+        m_top_y = scratch.m_top_y;
+        const int old_w = m_width;
+        const int old_h = m_height;
+        m_width = scratch.m_width;
+        m_height = scratch.m_height;
+        scratch.clear();
+        if (m_pixel_size > 0)
+            pixels_apply_moves(old_w, old_h);
+    }
+
+    // Pixel store: rows of `m_pixel_pitch` bytes, for the whole atlas size.
+
+    size_t pixels_pitch(int w) const
+    {
+        const size_t align = size_t(m_pixel_row_align);
+        return (size_t(w) * m_pixel_size + align - 1) & ~(align - 1);
+    }
+
+    void pixels_reset()
+    {
+        m_pixel_pitch = pixels_pitch(m_width);
+        m_pixels.assign(m_pixel_pitch * m_height, 0);
+    }
+
+    // Changes pixel store layout for the current atlas size, keeping the contents
+    // of the area that was within old size.
+    void pixels_resize(int old_w, int old_h)
+    {
+        const size_t old_pitch = m_pixel_pitch;
+        const size_t new_pitch = pixels_pitch(m_width);
+        const size_t row_size = size_t(std::min(old_w, m_width)) * m_pixel_size;
+        const int rows = std::min(old_h, m_height);
+        if (new_pitch * m_height > m_pixels.size())
+            m_pixels.resize(new_pitch * m_height);
+        uint8_t* pix = m_pixels.data();
+        // rows move towards the end when pitch grows, and towards the start
+        // when it shrinks; go in the order that never overwrites unmoved rows
+        for (int i = 0; i < rows; ++i) {
+            const int y = new_pitch >= old_pitch ? rows - 1 - i : i;
+            memmove(pix + y * new_pitch, pix + y * old_pitch, row_size);
+            memset(pix + y * new_pitch + row_size, 0, new_pitch - row_size);
+        }
+        memset(pix + rows * new_pitch, 0, (m_height - rows) * new_pitch);
+        m_pixels.resize(new_pitch * m_height);
+        m_pixel_pitch = new_pitch;
+    }
+
+    // Moves pixels of items that were moved by a repack: pixels of all moved items
+    // are first gathered into a temporary buffer, so that new positions can
+    // overlap old positions of other items.
+    void pixels_apply_moves(int old_w, int old_h)
+    {
+        size_t temp_size = 0;
+        for (const smol_item_move_t& move : m_repack_moves)
+            temp_size += size_t(move.item->width) * move.item->height * m_pixel_size;
+        m_pixel_temp.resize(temp_size);
+
+        uint8_t* temp = m_pixel_temp.data();
+        for (const smol_item_move_t& move : m_repack_moves) {
+            const size_t row_size = size_t(move.item->width) * m_pixel_size;
+            smol_copy_rect(temp, row_size, m_pixels.data() + move.old_y * m_pixel_pitch + move.old_x * m_pixel_size, m_pixel_pitch, row_size, move.item->height);
+            temp += row_size * move.item->height;
+        }
+
+        if (old_w != m_width || old_h != m_height)
+            pixels_resize(old_w, old_h);
+
+        temp = m_pixel_temp.data();
+        for (const smol_item_move_t& move : m_repack_moves) {
+            const smol_atlas_item_t* item = move.item;
+            const size_t row_size = size_t(item->width) * m_pixel_size;
+            smol_copy_rect(m_pixels.data() + item->y * m_pixel_pitch + item->x * m_pixel_size, m_pixel_pitch, temp, row_size, row_size, item->height);
+            temp += row_size * item->height;
+        }
+    }
+
+    void set_size(int w, int h)
+    {
+        assert(w <= SMOL_MAX_ATLAS_SIZE && h <= SMOL_MAX_ATLAS_SIZE);
+        m_width = w < SMOL_MAX_ATLAS_SIZE ? w : SMOL_MAX_ATLAS_SIZE;
+        m_height = h < SMOL_MAX_ATLAS_SIZE ? h : SMOL_MAX_ATLAS_SIZE;
+    }
+
+    // bottom of the lowest shelf (or skyline segment): the atlas can be made
+    // that short without moving any items
+    int used_height() const
+    {
+        if (!(m_flags & SMA_ATLAS_SKYLINE))
+            return m_top_y;
+        int res = 0;
+        for (const smol_skyline_node_t* node = m_skyline.m_nodes.m_head; node != nullptr; node = node->next)
+            res = max_i(res, node->y);
+        return res;
+    }
+
+    // changes atlas height without moving items; fails if that would cut off
+    // used space, or if an async repack is in progress
+    bool set_height_in_place(int h)
+    {
+        if (h < used_height() || h > SMOL_MAX_ATLAS_SIZE || m_async_active)
+            return false;
+        const int old_h = m_height;
+        m_height = h;
+        if (m_pixel_size > 0)
+            pixels_resize(m_width, old_h);
+        return true;
+    }
+
+    smol_pool_t<smol_atlas_item_t> m_item_pool;
+    smol_pool_t<smol_free_span_t> m_span_pool;
+    smol_pool_t<smol_skyline_node_t> m_skyline_pool;
+    smol_skyline_t m_skyline; // skyline mode: used instead of shelves
+    std::vector<smol_shelf_t> m_shelves;
+    // shelf heights and widest free spans, in a form suitable for SIMD search
+    std::vector<int> m_shelf_heights;
+    std::vector<int> m_shelf_max_free;
+    std::vector<smol_free_row_t> m_free_rows;
+    std::vector<smol_column_t> m_columns; // sub-shelf mode columns
+    std::vector<int> m_pinned_shelves; // indices of shelves dedicated to pinned items
+    int m_pinned_count = 0;
+    int m_top_y = 0; // bottom of the lowest shelf
+    int m_width;
+    int m_height;
+    const int m_flags;
+    std::vector<smol_slab_class_t> m_slab_classes; // slab mode: per width size class info
+
+    // repacking state, kept around to not allocate memory on each repack
+    smol_atlas_t* m_repack_scratch = nullptr;
+    std::vector<smol_atlas_item_t*> m_repack_items;
+    std::vector<smol_item_size_t> m_repack_sizes;
+    std::vector<int> m_repack_order;
+    std::vector<smol_atlas_item_t*> m_repack_results;
+    std::vector<smol_item_move_t> m_repack_moves;
+    std::vector<smol_atlas_item_t> m_repack_places;
+    std::vector<smol_repack_shelf_t> m_repack_shelves;
+    std::vector<int> m_repack_shelf_map;
+    std::vector<int> m_repack_shelf_order;
+    bool m_repack_pinned = false; // were there pinned items at repack start
+    std::atomic<uint32_t> m_epoch{ 0 }; // incremented twice by each repack, see sma_atlas_epoch
+
+    // optional pixel store
+    int m_pixel_size = 0; // bytes per pixel; zero if there is no pixel store
+    int m_pixel_row_align = 1;
+    size_t m_pixel_pitch = 0;
+    std::vector<uint8_t> m_pixels;
+    std::vector<uint8_t> m_pixel_temp; // pixels of moved items during repack
+
+    // upload batching state
+    int m_upload_pixel_size = 0;
+    int m_upload_row_align = 1;
+    std::vector<smol_upload_item_t> m_upload_items;
+    std::vector<uint8_t> m_upload_pushed; // pushed item pixels, tightly packed
+    std::vector<uint8_t> m_upload_buffer;
+    std::vector<smol_upload_region_t> m_upload_regions;
+
+    // async repack state
+    std::thread m_async_thread;
+    std::atomic<bool> m_async_done{ false };
+    bool m_async_active = false;
+    bool m_async_ok = false;
+    std::vector<smol_atlas_item_t*> m_async_added;
+    std::vector<smol_atlas_item_t*> m_async_removed;
+};
+
+smol_atlas_t* sma_atlas_create(int width, int height, int flags)
+{
+    return new smol_atlas_t(width, height, flags);
+}
+
+void sma_atlas_destroy(smol_atlas_t* atlas)
+{
+    delete atlas;
+}
+
+int sma_atlas_width(const smol_atlas_t* atlas)
+{
+    return atlas->m_width;
+}
+
+int sma_atlas_height(const smol_atlas_t* atlas)
+{
+    return atlas->m_height;
+}
+
+smol_atlas_item_t* sma_item_add(smol_atlas_t* atlas, int width, int height)
+{
+    return atlas->pack(width, height, (atlas->m_flags & (SMA_ATLAS_ROTATE | SMA_ATLAS_SLABS)) == SMA_ATLAS_ROTATE);
+}
+
+void sma_item_remove(smol_atlas_t* atlas, smol_atlas_item_t* item)
+{
+    atlas->free_item(item);
+}
+
+smol_atlas_item_t* sma_item_add_pinned(smol_atlas_t* atlas, int width, int height)
+{
+    return atlas->add_pinned(width, height);
+}
+
+bool sma_item_set_pinned(smol_atlas_t* atlas, smol_atlas_item_t* item, bool pinned)
+{
+    return atlas->set_pinned(item, pinned);
+}
+
+bool sma_item_resize(smol_atlas_t* atlas, smol_atlas_item_t* item, int new_width, int new_height, bool* out_moved)
+{
+    bool moved = false;
+    const bool res = atlas->resize_item(item, new_width, new_height, moved);
+    if (out_moved)
+        *out_moved = moved;
+    return res;
+}
+
+void sma_atlas_clear(smol_atlas_t* atlas, int new_width, int new_height)
+{
+    atlas->clear();
+    atlas->set_size(new_width > 0 ? new_width : atlas->m_width, new_height > 0 ? new_height : atlas->m_height);
+    if (atlas->m_pixel_size > 0)
+        atlas->pixels_reset();
+}
+
+template <typename T>
+static smol_pool_stats_t smol_pool_stats(const smol_pool_t<T>& pool)
+{
+    return { pool.m_used, pool.m_capacity, pool.m_high_water, pool.bytes() };
+}
+
+void sma_atlas_memory(const smol_atlas_t* atlas, smol_atlas_memory_t* out_memory)
+{
+    out_memory->items = smol_pool_stats(atlas->m_item_pool);
+    out_memory->spans = smol_pool_stats(atlas->m_span_pool);
+    out_memory->skyline_nodes = smol_pool_stats(atlas->m_skyline_pool);
+}
+
+size_t sma_atlas_trim(smol_atlas_t* atlas)
+{
+    return atlas->trim();
+}
+
+void sma_atlas_reserve(smol_atlas_t* atlas, int items, int spans, int shelves)
+{
+    atlas->reserve(items, spans, shelves);
+}
+
+int sma_atlas_prewarm_shelves(smol_atlas_t* atlas, const int* heights, const int* counts, int count)
+{
+    return atlas->prewarm_shelves(heights, counts, count);
+}
+
+void sma_atlas_attach_pixels(smol_atlas_t* atlas, sma_pixel_format format, int row_alignment)
+{
+    assert(row_alignment > 0 && (row_alignment & (row_alignment - 1)) == 0);
+    atlas->m_pixel_size = int(format);
+    atlas->m_pixel_row_align = row_alignment > 0 ? row_alignment : 1;
+    atlas->pixels_reset();
+}
+
+void* sma_atlas_pixels(smol_atlas_t* atlas, int* out_row_pitch)
+{
+    if (out_row_pitch)
+        *out_row_pitch = int(atlas->m_pixel_pitch);
+    return atlas->m_pixel_size > 0 ? atlas->m_pixels.data() : nullptr;
+}
+
+void sma_item_write_pixels(smol_atlas_t* atlas, const smol_atlas_item_t* item, const void* pixels, int row_pitch)
+{
+    if (atlas->m_pixel_size == 0 || item == nullptr)
+        return;
+    uint8_t* dst = atlas->m_pixels.data() + item->y * atlas->m_pixel_pitch + item->x * atlas->m_pixel_size;
+    smol_copy_item_pixels(dst, atlas->m_pixel_pitch, item, pixels, row_pitch, atlas->m_pixel_size);
+}
+
+bool sma_atlas_repack(smol_atlas_t* atlas, smol_atlas_item_t** items, int count, int flags, int new_width, int new_height)
+{
+    return atlas->repack(items, count, flags, new_width > 0 ? new_width : atlas->m_width, new_height > 0 ? new_height : atlas->m_height);
+}
+
+// Minimal size search: for a given width, shelf packing of height-sorted items
+// produces the same layout no matter what the atlas height is (as long as it fits),
+// so each candidate width needs just one packing pass to find its minimal height.
+
+static inline int smol_next_pow2(int v)
+{
+    int r = 1;
+    while (r < v)
+        r <<= 1;
+    return r;
+}
+
+struct smol_min_size_search_t
+{
+    const smol_item_size_t* items;
+    int count;
+    smol_size_constraints_t cons;
+    std::vector<int> order;
+    std::vector<int> widths;
+    int max_item_w = 0;
+    int max_item_h = 0;
+    int64_t total_area = 0;
+
+    int round_to_step(int v) const
+    {
+        const int step = max_i(1, cons.size_step);
+        return (v + step - 1) / step * step;
+    }
+
+    // fills in height for given width; returns false if no valid height
+    bool height_for_used(int w, int used_h, int& out_h) const
+    {
+        int h = max_i(1, used_h);
+        if (cons.square)
+            h = w;
+        if (cons.max_aspect > 0.0f) {
+            // too wide: make it taller
+            const int min_h = int(w / cons.max_aspect + 0.999f);
+            h = max_i(h, min_h);
+        }
+        h = cons.power_of_two ? smol_next_pow2(h) : round_to_step(h);
+        if (h < used_h || h > cons.max_height)
+            return false;
+        if (cons.max_aspect > 0.0f && h > w * cons.max_aspect)
+            return false;
+        out_h = h;
+        return true;
+    }
+
+    // lower bound of atlas area for given width
+    int64_t area_bound(int w) const
+    {
+        int h = max_i(max_item_h, int((total_area + w - 1) / w));
+        if (!height_for_used(w, h, h))
+            return INT64_MAX;
+        return int64_t(w) * h;
+    }
+
+    // packs all items into atlas of given width; returns used height or -1
+    int pack_width(smol_atlas_t& atlas, int w) const
+    {
+        sma_atlas_clear(&atlas, w, cons.max_height);
+        for (int idx : order) {
+            if (atlas.pack(items[idx].width, items[idx].height) == nullptr)
+                return -1;
+        }
+        return atlas.m_top_y;
+    }
+};
+
+smol_atlas_t* sma_atlas_find_min_size(const smol_item_size_t* items, int count, const smol_size_constraints_t* constraints, smol_atlas_item_t** out_items)
 {
-    atlas->free_item(item);
+    if (items == nullptr || count <= 0)
+        return nullptr;
+    smol_min_size_search_t search;
+    search.items = items;
+    search.count = count;
+    if (constraints)
+        search.cons = *constraints;
+    const smol_size_constraints_t& cons = search.cons;
+
+    for (int i = 0; i < count; ++i) {
+        search.max_item_w = max_i(search.max_item_w, items[i].width);
+        search.max_item_h = max_i(search.max_item_h, items[i].height);
+        search.total_area += int64_t(items[i].width) * items[i].height;
+    }
+    if (search.max_item_w > cons.max_width || search.max_item_h > cons.max_height)
+        return nullptr;
+
+    // sort by decreasing height, then width
+    search.order.resize(count);
+    for (int i = 0; i < count; ++i)
+        search.order[i] = i;
+    std::sort(search.order.begin(), search.order.end(), [&](int a, int b) {
+        if (items[a].height != items[b].height) return items[a].height > items[b].height;
+        if (items[a].width != items[b].width) return items[a].width > items[b].width;
+        return a < b;
+    });
+
+    // candidate widths, ordered by their area lower bound
+    const int step = cons.power_of_two ? 0 : max_i(1, cons.size_step);
+    const int min_w = max_i(1, search.max_item_w);
+    for (int w = cons.power_of_two ? smol_next_pow2(min_w) : search.round_to_step(min_w); w <= cons.max_width; w = step ? w + step : w * 2) {
+        if (search.area_bound(w) != INT64_MAX)
+            search.widths.push_back(w);
+    }
+    std::stable_sort(search.widths.begin(), search.widths.end(), [&](int a, int b) {
+        return search.area_bound(a) < search.area_bound(b);
+    });
+
+    // evaluate candidates on several threads; skip those whose bound
+    // can not beat the best found so far
+    const int cand_count = int(search.widths.size());
+    std::vector<int> heights(cand_count, -1);
+    std::atomic<int64_t> best_area(INT64_MAX);
+    std::atomic<int> next_cand(0);
+    auto worker = [&]() {
+        smol_atlas_t atlas(search.max_item_w, cons.max_height, 0);
+        while (true) {
+            const int idx = next_cand.fetch_add(1);
+            if (idx >= cand_count)
+                break;
+            const int w = search.widths[idx];
+            if (search.area_bound(w) > best_area.load())
+                continue;
+            const int used_h = search.pack_width(atlas, w);
+            int h;
+            if (used_h < 0 || !search.height_for_used(w, used_h, h))
+                continue;
+            heights[idx] = h;
+            const int64_t area = int64_t(w) * h;
+            int64_t prev = best_area.load();
+            while (area < prev && !best_area.compare_exchange_weak(prev, area)) {}
+        }
+    };
+    int thread_count = cons.threads > 0 ? cons.threads : int(std::thread::hardware_concurrency());
+    thread_count = max_i(1, std::min(thread_count, cand_count));
+    std::vector<std::thread> threads;
+    for (int i = 1; i < thread_count; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread& t : threads)
+        t.join();
+
+    // pick smallest area; on ties prefer more square, then wider (fewer shelves)
+    int best = -1;
+    for (int i = 0; i < cand_count; ++i) {
+        if (heights[i] < 0)
+            continue;
+        if (best < 0) {
+            best = i;
+            continue;
+        }
+        const int64_t area_i = int64_t(search.widths[i]) * heights[i];
+        const int64_t area_b = int64_t(search.widths[best]) * heights[best];
+        const int side_i = max_i(search.widths[i], heights[i]);
+        const int side_b = max_i(search.widths[best], heights[best]);
+        if (area_i < area_b || (area_i == area_b && (side_i < side_b || (side_i == side_b && search.widths[i] > search.widths[best]))))
+            best = i;
+    }
+    if (best < 0)
+        return nullptr;
+
+    smol_atlas_t* atlas = new smol_atlas_t(search.widths[best], heights[best], 0);
+    for (int idx : search.order) {
+        smol_atlas_item_t* item = atlas->pack(items[idx].width, items[idx].height);
+        assert(item);
+        if (out_items)
+            out_items[idx] = item;
+    }
+    return atlas;
 }
 
-void sma_atlas_clear(smol_atlas_t* atlas, int new_width, int new_height)
+// Composite atlas: horizontal bands of full atlas width, one per item height
+// class, stacked top to bottom in class order. Each band is a regular atlas
+// with local coordinates, so items of different classes never share shelves.
+// Area that is not in any band yet is at the bottom; bands start out empty and
+// grow from there as needed, or take the unused bottom part of other bands.
+// Items are routed by their original (not rotated) height, both when adding
+// and removing them, so nothing needs to be stored per item.
+struct smol_composite_region_t
 {
-    atlas->clear();
-    if (new_width > 0) atlas->m_width = new_width;
-    if (new_height > 0) atlas->m_height = new_height;
+    smol_atlas_t* atlas;
+    int max_height; // tallest item height of the class
+    int y;
+};
+
+struct smol_composite_t
+{
+    smol_composite_t(int w, int h, const int* class_max_heights, int class_count, int flags)
+        : m_width(w > 0 ? w : 64), m_height(h > 0 ? h : 64), m_flags(flags)
+    {
+        m_regions.reserve(class_count);
+        for (int i = 0; i < class_count; ++i) {
+            smol_atlas_t* atlas = new smol_atlas_t(m_width, 1, flags);
+            atlas->set_height_in_place(0);
+            m_regions.push_back({ atlas, class_max_heights[i], 0 });
+        }
+    }
+
+    ~smol_composite_t()
+    {
+        for (smol_composite_region_t& region : m_regions)
+            delete region.atlas;
+    }
+
+    int class_index(int h) const
+    {
+        const int count = int(m_regions.size());
+        for (int i = 0; i < count - 1; ++i) {
+            if (h <= m_regions[i].max_height)
+                return i;
+        }
+        return count - 1;
+    }
+
+    smol_atlas_item_t* add(int w, int h)
+    {
+        m_region_moves.clear();
+        if (m_regions.empty() || w > m_width)
+            return nullptr;
+        smol_composite_region_t& region = m_regions[class_index(h)];
+        const bool allow_rotate = (m_flags & (SMA_ATLAS_ROTATE | SMA_ATLAS_SLABS)) == SMA_ATLAS_ROTATE;
+        smol_atlas_item_t* res = region.atlas->pack(w, h, allow_rotate);
+        if (res == nullptr) {
+            // no room in the band: make it taller, so that a new shelf fits below the used part
+            const smol_atlas_t* atlas = region.atlas;
+            const int need = max_i(1, h - (atlas->m_height - atlas->used_height()));
+            if (grow_region(int(&region - m_regions.data()), need))
+                res = region.atlas->pack(w, h, allow_rotate);
+        }
+        return res;
+    }
+
+    void remove(smol_atlas_item_t* item)
+    {
+        if (item == nullptr)
+            return;
+        const int h = item->rotated ? item->width : item->height;
+        m_regions[class_index(h)].atlas->free_item(item);
+    }
+
+    // Makes the band at least `need` taller. Takes free area at the bottom first (a
+    // quarter of band height more than needed, if there is that much, to not move
+    // bands for every new shelf), then unused space of other bands, nearest first.
+    bool grow_region(int index, int need)
+    {
+        if (m_regions[index].atlas->m_async_active)
+            return false;
+        const int count = int(m_regions.size());
+        int total = 0, slack = 0;
+        for (int i = 0; i < count; ++i) {
+            const smol_atlas_t* atlas = m_regions[i].atlas;
+            total += atlas->m_height;
+            if (i != index && !atlas->m_async_active)
+                slack += atlas->m_height - atlas->used_height();
+        }
+        const int free_bottom = m_height - total;
+        if (free_bottom + slack < need)
+            return false;
+
+        smol_atlas_t* grown = m_regions[index].atlas;
+        int amount = std::min(free_bottom, need + grown->m_height / 4);
+        for (int dist = 1; amount < need && dist < count; ++dist) {
+            for (int i : { index + dist, index - dist }) {
+                if (i < 0 || i >= count || amount >= need)
+                    continue;
+                smol_atlas_t* atlas = m_regions[i].atlas;
+                if (atlas->m_async_active)
+                    continue;
+                const int take = std::min(need - amount, atlas->m_height - atlas->used_height());
+                atlas->set_height_in_place(atlas->m_height - take);
+                amount += take;
+            }
+        }
+        grown->set_height_in_place(grown->m_height + amount);
+        int y = 0;
+        for (int i = 0; i < count; ++i) {
+            smol_composite_region_t& region = m_regions[i];
+            if (region.y != y && region.atlas->used_height() > 0)
+                m_region_moves.push_back({ i, region.y, y });
+            region.y = y;
+            y += region.atlas->m_height;
+        }
+        return true;
+    }
+
+    void clear()
+    {
+        for (smol_composite_region_t& region : m_regions) {
+            region.atlas->clear();
+            region.atlas->set_height_in_place(0);
+            region.y = 0;
+        }
+        m_region_moves.clear();
+    }
+
+    std::vector<smol_composite_region_t> m_regions;
+    std::vector<smol_region_move_t> m_region_moves; // regions moved by the last add
+    const int m_width;
+    const int m_height;
+    const int m_flags;
+};
+
+smol_composite_t* sma_composite_create(int width, int height, const int* class_max_heights, int class_count, int flags)
+{
+    return new smol_composite_t(width, height, class_max_heights, class_count, flags);
+}
+
+void sma_composite_destroy(smol_composite_t* comp)
+{
+    delete comp;
+}
+
+smol_atlas_item_t* sma_composite_item_add(smol_composite_t* comp, int width, int height)
+{
+    return comp->add(width, height);
+}
+
+int sma_composite_region_moves(const smol_composite_t* comp, const smol_region_move_t** out_moves)
+{
+    if (out_moves)
+        *out_moves = comp->m_region_moves.empty() ? nullptr : comp->m_region_moves.data();
+    return int(comp->m_region_moves.size());
+}
+
+void sma_composite_item_remove(smol_composite_t* comp, smol_atlas_item_t* item)
+{
+    comp->remove(item);
+}
+
+int sma_composite_item_y(const smol_composite_t* comp, const smol_atlas_item_t* item)
+{
+    const int h = item->rotated ? item->width : item->height;
+    return comp->m_regions[comp->class_index(h)].y + item->y;
+}
+
+int sma_composite_region_count(const smol_composite_t* comp)
+{
+    return int(comp->m_regions.size());
+}
+
+smol_atlas_t* sma_composite_region(smol_composite_t* comp, int index, int* out_y)
+{
+    if (out_y)
+        *out_y = comp->m_regions[index].y;
+    return comp->m_regions[index].atlas;
+}
+
+void sma_composite_clear(smol_composite_t* comp)
+{
+    comp->clear();
+}
+
+int sma_atlas_repack_moves(const smol_atlas_t* atlas, const smol_item_move_t** out_moves)
+{
+    if (out_moves)
+        *out_moves = atlas->m_repack_moves.empty() ? nullptr : atlas->m_repack_moves.data();
+    return int(atlas->m_repack_moves.size());
+}
+
+bool sma_atlas_repack_async_begin(smol_atlas_t* atlas, smol_atlas_item_t** items, int count, int flags, int new_width, int new_height)
+{
+    return atlas->repack_async_begin(items, count, flags, new_width > 0 ? new_width : atlas->m_width, new_height > 0 ? new_height : atlas->m_height);
+}
+
+bool sma_atlas_repack_async_is_done(const smol_atlas_t* atlas)
+{
+    return !atlas->m_async_active || atlas->m_async_done.load(std::memory_order_acquire);
+}
+
+int sma_atlas_repack_async_finish(smol_atlas_t* atlas, const smol_item_move_t** out_moves)
+{
+    int res = atlas->repack_async_finish();
+    if (out_moves)
+        *out_moves = res > 0 ? atlas->m_repack_moves.data() : nullptr;
+    return res;
+}
+
+void sma_upload_begin(smol_atlas_t* atlas, sma_pixel_format format, int row_alignment)
+{
+    assert(row_alignment > 0 && (row_alignment & (row_alignment - 1)) == 0);
+    atlas->m_upload_pixel_size = int(format);
+    atlas->m_upload_row_align = row_alignment > 0 ? row_alignment : 1;
+    atlas->m_upload_items.clear();
+    atlas->m_upload_pushed.clear();
+}
+
+void sma_upload_push(smol_atlas_t* atlas, const smol_atlas_item_t* item, const void* pixels, int row_pitch)
+{
+    assert(atlas->m_upload_pixel_size > 0);
+    if (item == nullptr)
+        return;
+    const size_t row_size = size_t(item->width) * atlas->m_upload_pixel_size;
+    const size_t offset = atlas->m_upload_pushed.size();
+    atlas->m_upload_pushed.resize(offset + row_size * item->height);
+    smol_copy_item_pixels(atlas->m_upload_pushed.data() + offset, row_size, item, pixels, row_pitch, atlas->m_upload_pixel_size);
+    atlas->m_upload_items.push_back({ item, offset });
+}
+
+// Items are sorted by shelf (i.e. Y coordinate) and X coordinate; runs of
+// horizontally adjacent items on the same shelf are merged into one region.
+// Items within a run can have different heights; area below the shorter
+// ones belongs to their shelf and is never used by other items, so it
+// is filled with zeros.
+int sma_upload_end(smol_atlas_t* atlas, const void** out_buffer, size_t* out_buffer_size, const smol_upload_region_t** out_regions)
+{
+    std::vector<smol_upload_item_t>& items = atlas->m_upload_items;
+    std::vector<smol_upload_region_t>& regions = atlas->m_upload_regions;
+    std::vector<uint8_t>& buffer = atlas->m_upload_buffer;
+    const int pixel_size = atlas->m_upload_pixel_size;
+    const size_t align = size_t(atlas->m_upload_row_align);
+    const bool skyline = (atlas->m_flags & SMA_ATLAS_SKYLINE) != 0;
+
+    std::sort(items.begin(), items.end(), [](const smol_upload_item_t& a, const smol_upload_item_t& b) {
+        if (a.item->y != b.item->y) return a.item->y < b.item->y;
+        return a.item->x < b.item->x;
+    });
+
+    // regions and their buffer layout
+    regions.clear();
+    size_t buffer_size = 0;
+    for (size_t i = 0; i < items.size(); ) {
+        const smol_atlas_item_t* first = items[i].item;
+        smol_upload_region_t region = { 0, 0, first->x, first->y, first->width, first->height };
+        size_t end = i + 1;
+        // column and skyline items can have other items below them, so they are
+        // only merged with items of the same height
+        while (end < items.size() && items[end].item->y == region.y && items[end].item->x == region.x + region.width &&
+               (items[end].item->height == region.height || (!skyline && !first->in_column && !items[end].item->in_column))) {
+            region.width += items[end].item->width;
+            region.height = max_i(region.height, items[end].item->height);
+            ++end;
+        }
+        region.row_pitch = int((size_t(region.width) * pixel_size + align - 1) & ~(align - 1));
+        region.offset = (buffer_size + align - 1) & ~(align - 1);
+        buffer_size = region.offset + size_t(region.row_pitch) * region.height;
+        regions.push_back(region);
+        i = end;
+    }
+
+    // copy pixels of items into their regions
+    buffer.assign(buffer_size, 0);
+    size_t item_idx = 0;
+    for (const smol_upload_region_t& region : regions) {
+        for (int x = region.x; x < region.x + region.width; ++item_idx) {
+            const smol_upload_item_t& it = items[item_idx];
+            const size_t row_size = size_t(it.item->width) * pixel_size;
+            uint8_t* dst = buffer.data() + region.offset + size_t(x - region.x) * pixel_size;
+            smol_copy_rect(dst, region.row_pitch, atlas->m_upload_pushed.data() + it.offset, row_size, row_size, it.item->height);
+            x += it.item->width;
+        }
+    }
+
+    items.clear();
+    atlas->m_upload_pushed.clear();
+    if (out_buffer)
+        *out_buffer = buffer.empty() ? nullptr : buffer.data();
+    if (out_buffer_size)
+        *out_buffer_size = buffer_size;
+    if (out_regions)
+        *out_regions = regions.empty() ? nullptr : regions.data();
+    return int(regions.size());
+}
+
+// Converts a float to half float, rounding to nearest even. Values too large
+// for a half become infinity; NaNs stay NaNs.
+static inline uint16_t smol_float_to_half(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, 4);
+    const uint32_t sign = (u >> 16) & 0x8000;
+    u &= 0x7FFFFFFF;
+    if (u >= 0x7F800000) // inf or NaN
+        return uint16_t(sign | 0x7C00 | (u > 0x7F800000 ? 0x200 : 0));
+    if (u >= 0x477FF000) // rounds to larger than max half
+        return uint16_t(sign | 0x7C00);
+    if (u < 0x38800000) { // half denormal or zero
+        const uint32_t mant = (u & 0x7FFFFF) | 0x800000;
+        const int shift = 126 - int(u >> 23);
+        if (shift > 24)
+            return uint16_t(sign);
+        const uint32_t half = mant >> shift;
+        const uint32_t rest = mant & ((1u << shift) - 1);
+        const uint32_t mid = 1u << (shift - 1);
+        return uint16_t(sign | (half + (rest > mid || (rest == mid && (half & 1)))));
+    }
+    const uint32_t rounded = u + 0xFFF + ((u >> 13) & 1) - 0x38000000;
+    return uint16_t(sign | (rounded >> 13));
+}
+
+// UV rectangles are item (x, y, x+width, y+height), divided by atlas size.
+// SIMD paths compute all four values of an item at once.
+void sma_atlas_write_uvs(const smol_atlas_t* atlas, const smol_atlas_item_t* const* items, int count, void* out, sma_uv_format format, int stride)
+{
+    const size_t value_size = format == SMA_UV_FLOAT32 ? 4 : 2;
+    const size_t step = stride > 0 ? size_t(stride) : value_size * 4;
+    const float inv_w = 1.0f / float(atlas->m_width);
+    const float inv_h = 1.0f / float(atlas->m_height);
+    uint8_t* dst = (uint8_t*)out;
+#if SMOL_SIMD_AVX2 || SMOL_SIMD_SSE2
+    const __m128 scale = _mm_setr_ps(inv_w, inv_h, inv_w, inv_h);
+    for (int i = 0; i < count; ++i, dst += step) {
+        const smol_atlas_item_t* item = items[i];
+#if SMOL_ATLAS_16BIT_COORDS
+        const __m128i xywh = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)&item->x), _mm_setzero_si128());
+#else
+        const __m128i xywh = _mm_loadu_si128((const __m128i*)&item->x);
+#endif
+        // (x, y, w, h) + (0, 0, x, y)
+        const __m128 uv = _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(xywh, _mm_slli_si128(xywh, 8))), scale);
+        if (format == SMA_UV_FLOAT32) {
+            _mm_storeu_ps((float*)dst, uv);
+        }
+        else if (format == SMA_UV_UNORM16) {
+            // pack with signed saturation, after moving the range to be signed
+            const __m128i v = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(uv, _mm_set1_ps(65535.0f)), _mm_set1_ps(0.5f))), _mm_set1_epi32(32768));
+            _mm_storel_epi64((__m128i*)dst, _mm_xor_si128(_mm_packs_epi32(v, v), _mm_set1_epi16(-32768)));
+        }
+        else {
+#if defined(__F16C__)
+            _mm_storel_epi64((__m128i*)dst, _mm_cvtps_ph(uv, _MM_FROUND_TO_NEAREST_INT));
+#else
+            alignas(16) float v[4];
+            _mm_store_ps(v, uv);
+            for (int j = 0; j < 4; ++j) {
+                const uint16_t h = smol_float_to_half(v[j]);
+                memcpy(dst + j * 2, &h, 2);
+            }
+#endif
+        }
+    }
+#elif SMOL_SIMD_NEON
+    const float scale_values[4] = { inv_w, inv_h, inv_w, inv_h };
+    const float32x4_t scale = vld1q_f32(scale_values);
+    for (int i = 0; i < count; ++i, dst += step) {
+        const smol_atlas_item_t* item = items[i];
+#if SMOL_ATLAS_16BIT_COORDS
+        const int32x4_t xywh = vreinterpretq_s32_u32(vmovl_u16(vld1_u16((const uint16_t*)&item->x)));
+#else
+        const int32x4_t xywh = vld1q_s32((const int32_t*)&item->x);
+#endif
+        // (x, y, w, h) + (0, 0, x, y)
+        const float32x4_t uv = vmulq_f32(vcvtq_f32_s32(vaddq_s32(xywh, vextq_s32(vdupq_n_s32(0), xywh, 2))), scale);
+        if (format == SMA_UV_FLOAT32)
+            vst1q_f32((float*)dst, uv);
+        else if (format == SMA_UV_UNORM16)
+            vst1_u16((uint16_t*)dst, vmovn_u32(vcvtq_u32_f32(vmlaq_n_f32(vdupq_n_f32(0.5f), uv, 65535.0f))));
+        else
+            vst1_u16((uint16_t*)dst, vreinterpret_u16_f16(vcvt_f16_f32(uv)));
+    }
+#else
+    for (int i = 0; i < count; ++i, dst += step) {
+        const smol_atlas_item_t* item = items[i];
+        const float uv[4] = { item->x * inv_w, item->y * inv_h, (item->x + item->width) * inv_w, (item->y + item->height) * inv_h };
+        for (int j = 0; j < 4; ++j) {
+            if (format == SMA_UV_FLOAT32) {
+                memcpy(dst + j * 4, &uv[j], 4);
+            }
+            else {
+                const uint16_t v = format == SMA_UV_UNORM16 ? uint16_t(uv[j] * 65535.0f + 0.5f) : smol_float_to_half(uv[j]);
+                memcpy(dst + j * 2, &v, 2);
+            }
+        }
+    }
+#endif
+}
+
+void sma_atlas_for_each_item(smol_atlas_t* atlas, void (*callback)(smol_atlas_item_t* item, void* user_ptr), void* user_ptr)
+{
+    atlas->for_each_item([&](smol_atlas_item_t* item) { callback(item, user_ptr); });
+}
+
+int sma_atlas_get_items(smol_atlas_t* atlas, smol_atlas_item_t** out_items, int max_count)
+{
+    int count = 0;
+    if (out_items != nullptr && max_count > 0) {
+        atlas->for_each_item([&](smol_atlas_item_t* item) {
+            if (count < max_count)
+                out_items[count++] = item;
+        });
+    }
+    return int(atlas->m_item_pool.m_used);
 }
 
 int sma_item_x(const smol_atlas_item_t* item)
@@ -401,3 +2868,337 @@ int sma_item_height(const smol_atlas_item_t* item)
 {
     return item->height;
 }
+bool sma_item_rotated(const smol_atlas_item_t* item)
+{
+    return item->rotated != 0;
+}
+void sma_item_set_user_data(smol_atlas_item_t* item, uint64_t data)
+{
+    item->user_data = data;
+}
+uint64_t sma_item_user_data(const smol_atlas_item_t* item)
+{
+    return item->user_data;
+}
+bool sma_item_pinned(const smol_atlas_item_t* item)
+{
+    return item->pinned != 0;
+}
+
+smol_item_rect_t sma_item_rect(const smol_atlas_item_t* item)
+{
+#if SMOL_ATLAS_CONCURRENT_READS
+    return item->published.load();
+#else
+    return { item->x, item->y, item->width, item->height };
+#endif
+}
+
+uint32_t sma_atlas_epoch(const smol_atlas_t* atlas)
+{
+    return atlas->m_epoch.load(std::memory_order_acquire);
+}
+
+// Shared atlas: a shelf atlas that lives entirely within one memory block,
+// so that it can be placed into shared memory and used by several processes
+// at once, each of which can have the block mapped at a different address.
+// Nothing in the block is a pointer: items, free spans and shelves are in
+// arrays, and refer to each other by index. Array locations are stored as
+// offsets from the block start. The block starts with the header below,
+// which also has a spin lock that guards all the modifications.
+//
+// Packing is the same Shelf Best Height Fit as regular atlases, with first
+// fit free spans within shelves; none of the optional modes are supported.
+static constexpr uint32_t SMOL_SHARED_MAGIC = 0x534D4131; // "SMA1"
+
+struct smol_shared_item_t
+{
+    int32_t x;
+    int32_t y;
+    int32_t width; // zero for free items
+    int32_t height;
+    int32_t shelf;
+    int32_t next; // next free item, when free
+};
+
+struct smol_shared_span_t
+{
+    int32_t x;
+    int32_t width;
+    int32_t next; // next span of the shelf (or of the free list); -1 at the end
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared atlas lock must be lock free to work across processes");
+
+struct smol_shared_atlas_t
+{
+    uint32_t m_magic;
+    std::atomic<uint32_t> m_lock;
+    int32_t m_width;
+    int32_t m_height;
+    int32_t m_item_capacity;
+    int32_t m_span_capacity;
+    int32_t m_shelf_capacity;
+    int32_t m_item_count;
+    int32_t m_item_bump; // items at this index and above were never used
+    int32_t m_free_item;
+    int32_t m_span_bump;
+    int32_t m_free_span;
+    int32_t m_shelf_count;
+    int32_t m_top_y;
+    uint64_t m_items_offset;
+    uint64_t m_spans_offset;
+    // shelf heights and widest free spans are separate arrays for smol_find_best_shelf
+    uint64_t m_shelf_heights_offset;
+    uint64_t m_shelf_max_free_offset;
+    uint64_t m_shelf_y_offset;
+    uint64_t m_shelf_spans_offset;
+
+    template<typename T> T* array(uint64_t offset) { return (T*)((char*)this + offset); }
+    smol_shared_item_t* items() { return array<smol_shared_item_t>(m_items_offset); }
+    smol_shared_span_t* spans() { return array<smol_shared_span_t>(m_spans_offset); }
+    int* shelf_heights() { return array<int>(m_shelf_heights_offset); }
+    int* shelf_max_free() { return array<int>(m_shelf_max_free_offset); }
+    int* shelf_y() { return array<int>(m_shelf_y_offset); }
+    int* shelf_spans() { return array<int>(m_shelf_spans_offset); }
+
+    static size_t layout(int item_capacity, int height, smol_shared_atlas_t* out)
+    {
+        // every shelf is at least one pixel tall; every item splits at most one free span
+        const int shelf_capacity = height;
+        const int span_capacity = item_capacity + shelf_capacity;
+        size_t size = (sizeof(smol_shared_atlas_t) + 15) & ~size_t(15);
+        const size_t items_offset = size;
+        size += sizeof(smol_shared_item_t) * item_capacity;
+        const size_t spans_offset = size;
+        size += sizeof(smol_shared_span_t) * span_capacity;
+        const size_t shelf_offset = size;
+        size += sizeof(int) * 4 * shelf_capacity;
+        if (out != nullptr) {
+            out->m_item_capacity = item_capacity;
+            out->m_span_capacity = span_capacity;
+            out->m_shelf_capacity = shelf_capacity;
+            out->m_items_offset = items_offset;
+            out->m_spans_offset = spans_offset;
+            out->m_shelf_heights_offset = shelf_offset;
+            out->m_shelf_max_free_offset = shelf_offset + sizeof(int) * shelf_capacity;
+            out->m_shelf_y_offset = shelf_offset + sizeof(int) * 2 * shelf_capacity;
+            out->m_shelf_spans_offset = shelf_offset + sizeof(int) * 3 * shelf_capacity;
+        }
+        return size;
+    }
+
+    void lock()
+    {
+        while (m_lock.exchange(1, std::memory_order_acquire) != 0) {
+            while (m_lock.load(std::memory_order_relaxed) != 0)
+                std::this_thread::yield();
+        }
+    }
+
+    void unlock()
+    {
+        m_lock.store(0, std::memory_order_release);
+    }
+
+    void clear()
+    {
+        m_item_count = 0;
+        m_item_bump = 0;
+        m_free_item = -1;
+        m_span_bump = 0;
+        m_free_span = -1;
+        m_shelf_count = 0;
+        m_top_y = 0;
+    }
+
+    int alloc_span(int x, int width)
+    {
+        int index = m_free_span;
+        if (index >= 0)
+            m_free_span = spans()[index].next;
+        else
+            index = m_span_bump++;
+        assert(index < m_span_capacity);
+        spans()[index] = { x, width, -1 };
+        return index;
+    }
+
+    void free_span(int index)
+    {
+        spans()[index].next = m_free_span;
+        m_free_span = index;
+    }
+
+    void update_max_free(int shelf)
+    {
+        int max_free = 0;
+        for (int it = shelf_spans()[shelf]; it >= 0; it = spans()[it].next)
+            max_free = max_i(max_free, spans()[it].width);
+        shelf_max_free()[shelf] = max_free;
+    }
+
+    int add(int w, int h)
+    {
+        if (w <= 0 || h <= 0 || w > m_width)
+            return -1;
+        if (m_free_item < 0 && m_item_bump == m_item_capacity)
+            return -1;
+        int shelf = smol_find_best_shelf(shelf_heights(), shelf_max_free(), m_shelf_count, w, h);
+        if (shelf < 0) {
+            if (h > m_height - m_top_y || m_shelf_count == m_shelf_capacity)
+                return -1;
+            shelf = m_shelf_count++;
+            shelf_heights()[shelf] = h;
+            shelf_max_free()[shelf] = m_width;
+            shelf_y()[shelf] = m_top_y;
+            shelf_spans()[shelf] = alloc_span(0, m_width);
+            m_top_y += h;
+        }
+
+        // take the start of first free span that is wide enough
+        smol_shared_span_t* spans = this->spans();
+        int prev = -1;
+        int it = shelf_spans()[shelf];
+        while (spans[it].width < w) {
+            prev = it;
+            it = spans[it].next;
+        }
+        const int x = spans[it].x;
+        if (spans[it].width > w) {
+            spans[it].x += w;
+            spans[it].width -= w;
+        }
+        else {
+            (prev >= 0 ? spans[prev].next : shelf_spans()[shelf]) = spans[it].next;
+            free_span(it);
+        }
+        update_max_free(shelf);
+
+        int index = m_free_item;
+        if (index >= 0)
+            m_free_item = items()[index].next;
+        else
+            index = m_item_bump++;
+        items()[index] = { x, shelf_y()[shelf], w, h, shelf, -1 };
+        ++m_item_count;
+        return index;
+    }
+
+    void remove(int index)
+    {
+        if (index < 0 || index >= m_item_bump || items()[index].width == 0)
+            return;
+        smol_shared_item_t& item = items()[index];
+        const int shelf = item.shelf;
+
+        // insert the free span in X order, and merge with neighbors
+        smol_shared_span_t* spans = this->spans();
+        int prev = -1;
+        int it = shelf_spans()[shelf];
+        while (it >= 0 && spans[it].x < item.x) {
+            prev = it;
+            it = spans[it].next;
+        }
+        int span;
+        if (prev >= 0 && spans[prev].x + spans[prev].width == item.x) {
+            span = prev;
+            spans[span].width += item.width;
+        }
+        else {
+            span = alloc_span(item.x, item.width);
+            spans[span].next = it;
+            (prev >= 0 ? spans[prev].next : shelf_spans()[shelf]) = span;
+        }
+        if (it >= 0 && spans[span].x + spans[span].width == spans[it].x) {
+            spans[span].width += spans[it].width;
+            spans[span].next = spans[it].next;
+            free_span(it);
+        }
+        shelf_max_free()[shelf] = max_i(shelf_max_free()[shelf], spans[span].width);
+
+        item.width = 0;
+        item.next = m_free_item;
+        m_free_item = index;
+        --m_item_count;
+    }
+};
+
+size_t sma_shared_atlas_size(int height, int max_items)
+{
+    return smol_shared_atlas_t::layout(max_items, height, nullptr);
+}
+
+smol_shared_atlas_t* sma_shared_atlas_init(void* memory, size_t size, int width, int height, int max_items)
+{
+    if (memory == nullptr || width <= 0 || height <= 0 || max_items <= 0 || size < sma_shared_atlas_size(height, max_items))
+        return nullptr;
+    smol_shared_atlas_t* atlas = new (memory) smol_shared_atlas_t();
+    smol_shared_atlas_t::layout(max_items, height, atlas);
+    atlas->m_width = width;
+    atlas->m_height = height;
+    atlas->clear();
+    atlas->m_lock.store(0, std::memory_order_relaxed);
+    atlas->m_magic = SMOL_SHARED_MAGIC;
+    std::atomic_thread_fence(std::memory_order_release);
+    return atlas;
+}
+
+smol_shared_atlas_t* sma_shared_atlas_attach(void* memory)
+{
+    smol_shared_atlas_t* atlas = (smol_shared_atlas_t*)memory;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return atlas != nullptr && atlas->m_magic == SMOL_SHARED_MAGIC ? atlas : nullptr;
+}
+
+int sma_shared_atlas_width(const smol_shared_atlas_t* atlas)
+{
+    return atlas->m_width;
+}
+
+int sma_shared_atlas_height(const smol_shared_atlas_t* atlas)
+{
+    return atlas->m_height;
+}
+
+int sma_shared_atlas_item_count(smol_shared_atlas_t* atlas)
+{
+    atlas->lock();
+    const int res = atlas->m_item_count;
+    atlas->unlock();
+    return res;
+}
+
+void sma_shared_atlas_clear(smol_shared_atlas_t* atlas)
+{
+    atlas->lock();
+    atlas->clear();
+    atlas->unlock();
+}
+
+int sma_shared_item_add(smol_shared_atlas_t* atlas, int width, int height)
+{
+    atlas->lock();
+    const int res = atlas->add(width, height);
+    atlas->unlock();
+    return res;
+}
+
+void sma_shared_item_remove(smol_shared_atlas_t* atlas, int item)
+{
+    atlas->lock();
+    atlas->remove(item);
+    atlas->unlock();
+}
+
+bool sma_shared_item_rect(smol_shared_atlas_t* atlas, int item, smol_item_rect_t* out_rect)
+{
+    atlas->lock();
+    const bool valid = item >= 0 && item < atlas->m_item_bump && atlas->items()[item].width > 0;
+    if (valid) {
+        const smol_shared_item_t& it = atlas->items()[item];
+        *out_rect = { it.x, it.y, it.width, it.height };
+    }
+    atlas->unlock();
+    return valid;
+}
@@ -3,6 +3,9 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 // 2D rectangular bin packing utility that uses the Shelf Best Height Fit
 // heuristic, and supports item removal. You could also call it a
 // dynamic texture atlas allocator.
@@ -18,18 +21,52 @@
 //   neighboring spans.
 // - Shelves, once created, stay at their height and location. Even if they
 //   become empty, they are not removed nor joined with nearby shelves.
+// - Optionally, short items can be stacked in "columns" within taller shelves.
+//
+// Alternatively, a skyline packing engine can be used, see `SMA_ATLAS_SKYLINE`.
 //
 // Implementation uses STL <vector>, and some manual memory allocation
 // with just regular `new` and `delete`. Custom allocators might be nice to
 // do someday.
 //
 // At least C++11 is required.
+//
+// Define SMOL_ATLAS_16BIT_COORDS to 1 when compiling smol-atlas.cpp to store
+// item coordinates as 16 bit integers. This makes items smaller, but limits
+// the atlas size to 65535 pixels.
 
 struct smol_atlas_t;
 struct smol_atlas_item_t;
 
-/// Create atlas of given size.
-smol_atlas_t* sma_atlas_create(int width, int height);
+/// Atlas creation flags, see `sma_atlas_create`.
+enum sma_atlas_flags
+{
+    /// Dedicate each shelf to one item width size class, and split it into
+    /// fixed size slots. Adding and removing items is then just a bitmask update,
+    /// and there is no fragmentation within shelves. Widths are rounded up to
+    /// four size classes per power of two, so this wastes some space; it works
+    /// best when many items have the same or similar sizes.
+    SMA_ATLAS_SLABS = 1 << 0,
+    /// Allow `sma_item_add` to place items rotated by 90 degrees clockwise, when
+    /// that fits an existing shelf better (or makes a less tall new shelf). See
+    /// `sma_item_rotated`. Repacks keep the item orientation. Not used together
+    /// with `SMA_ATLAS_SLABS`.
+    SMA_ATLAS_ROTATE = 1 << 1,
+    /// Allow short items to be stacked vertically within a part of a taller shelf
+    /// (a "column" of full shelf height), instead of wasting the shelf height above
+    /// them. Columns are given back to their shelf once they are empty. Packs
+    /// items of widely varying heights much tighter.
+    SMA_ATLAS_SUBSHELVES = 1 << 2,
+    /// Use skyline packing instead of shelves: items are placed at the lowest
+    /// position where they fit on top of the already placed ones. Packs items of
+    /// mixed heights tighter, but adding items is slower, and space is only
+    /// reclaimed when removed items are not below other items. Shelf options
+    /// (slabs, rotation, sub-shelves) and stable repacks are not used with it.
+    SMA_ATLAS_SKYLINE = 1 << 3,
+};
+
+/// Create atlas of given size. `flags` is a combination of `sma_atlas_flags`.
+smol_atlas_t* sma_atlas_create(int width, int height, int flags = 0);
 
 /// Destroy the atlas.
 void sma_atlas_destroy(smol_atlas_t* atlas);
@@ -51,16 +88,395 @@ smol_atlas_item_t* sma_item_add(smol_atlas_t* atlas, int width, int height);
 /// The item pointer becomes invalid and can no longer be used.
 void sma_item_remove(smol_atlas_t* atlas, smol_atlas_item_t* item);
 
+/// Add a pinned item: one that repacks never move (see `sma_item_set_pinned`).
+/// Pinned items are placed on shelves of their own, so that they do not keep the
+/// shelves of other items from being compacted. Returns NULL if there is no more
+/// space, or with `SMA_ATLAS_SKYLINE` (pinning is not supported there).
+smol_atlas_item_t* sma_item_add_pinned(smol_atlas_t* atlas, int width, int height);
+
+/// Pin or unpin an item. Pinned items stay in place in all repacks (stable or not),
+/// along with the shelves they are on; a repack fails if they do not fit into the
+/// new atlas size. Pinning takes effect from the next repack start. Returns false
+/// if the item can not be pinned: with `SMA_ATLAS_SKYLINE`, or for items within
+/// sub-shelf columns.
+bool sma_item_set_pinned(smol_atlas_t* atlas, smol_atlas_item_t* item, bool pinned);
+
+/// Change item size, e.g. when a thumbnail crop changes. The item is resized in place
+/// when possible: shrinking gives the rest of its space back, and growing uses free
+/// space right after it on its shelf. Otherwise the item is moved to a new place, as
+/// if it was added anew; `out_moved` (if not NULL) is set to whether that happened.
+/// Item pointer stays the same either way. Returns false if there is no room for the
+/// new size (or an async repack is in progress); then the item is left unchanged.
+/// For rotated items, the new size is in original orientation. Item pixels in the
+/// pixel store are not updated. Items of a composite atlas must keep their height
+/// within their size class.
+bool sma_item_resize(smol_atlas_t* atlas, smol_atlas_item_t* item, int new_width, int new_height, bool* out_moved = nullptr);
+
+/// Call `callback` for each item in the atlas, passing `user_ptr` along. Items are
+/// visited in the order they are in memory, not in the order they were added.
+/// Items must not be added or removed while iterating.
+void sma_atlas_for_each_item(smol_atlas_t* atlas, void (*callback)(smol_atlas_item_t* item, void* user_ptr), void* user_ptr);
+
+/// Get items that are in the atlas, in the same order as `sma_atlas_for_each_item`.
+/// Up to `max_count` of them are written into `out_items` (can be NULL).
+/// Returns the number of items in the atlas.
+int sma_atlas_get_items(smol_atlas_t* atlas, smol_atlas_item_t** out_items, int max_count);
+
 /// Clear the atlas. This invalidates any previously returned item pointers.
 /// If passed width and height are positive, the atlas size is also set
 /// to the new values.
 void sma_atlas_clear(smol_atlas_t* atlas, int new_width = 0, int new_height = 0);
 
+/// Memory use of one of the atlas internal pools, see `sma_atlas_memory`.
+struct smol_pool_stats_t
+{
+    /// Entries currently in use.
+    size_t used;
+    /// Entries that fit into the allocated memory.
+    size_t capacity;
+    /// Most entries in use at once, since atlas creation or last `sma_atlas_trim`.
+    size_t high_water;
+    /// Allocated memory in bytes.
+    size_t bytes;
+};
+
+/// Memory use of the atlas internal pools.
+struct smol_atlas_memory_t
+{
+    smol_pool_stats_t items;
+    /// Free spans within shelves (and columns).
+    smol_pool_stats_t spans;
+    /// Skyline nodes, only used with `SMA_ATLAS_SKYLINE`.
+    smol_pool_stats_t skyline_nodes;
+};
+
+/// Get memory use of the atlas internal pools.
+void sma_atlas_memory(const smol_atlas_t* atlas, smol_atlas_memory_t* out_memory);
+
+/// Release memory that is not in use right now: pool chunks without any used entries,
+/// and scratch memory of repacks (unless an async repack is in progress). Useful after
+/// a temporary peak of item count. Also resets the pool high water marks. Item pointers
+/// stay valid. Returns the number of bytes released.
+size_t sma_atlas_trim(smol_atlas_t* atlas);
+
+/// Allocate memory up front for the given number of items, free spans (skyline nodes
+/// with `SMA_ATLAS_SKYLINE`) and shelves, so that adding up to that many does not
+/// allocate. A shelf usually has a few free spans; one per shelf is the minimum.
+void sma_atlas_reserve(smol_atlas_t* atlas, int items, int spans, int shelves);
+
+/// Create empty shelves up front: `counts[i]` shelves of `heights[i]` height, for `count`
+/// entries of a height histogram, e.g. the glyph sizes of a font. Shelves are laid out
+/// tallest first, instead of in the order that items happen to arrive. Items of other
+/// heights still get new shelves as usual, and a full repack lays out shelves anew.
+/// Returns the number of shelves created; fewer than requested if the atlas is full.
+/// Does nothing with `SMA_ATLAS_SKYLINE`.
+int sma_atlas_prewarm_shelves(smol_atlas_t* atlas, const int* heights, const int* counts, int count);
+
+/// Repack flags, see `sma_atlas_repack`.
+enum sma_repack_flags
+{
+    /// Try several item orderings (by height, width, area, longer side), and
+    /// keep the one that uses the least atlas height. Slower, but often packs tighter.
+    SMA_REPACK_TRY_ORDERINGS = 1 << 0,
+    /// Keep items at their current positions where possible, and only move the
+    /// ones needed to make room: items of shelves that are less than half full,
+    /// or that no longer fit into a smaller atlas. Much fewer items move than with
+    /// a full repack, but packing is not as tight. Item orderings are not tried
+    /// in this mode.
+    SMA_REPACK_STABLE = 1 << 1,
+};
+
+/// Repack the given items within the atlas, e.g. to clean up fragmentation
+/// after many removals. `items` must contain all the items currently in the atlas.
+/// Items are sorted internally (by decreasing height, then width) for a good
+/// shelf fill. Item pointers stay valid; only their positions change.
+/// If new width and height are positive, the atlas size is also set to the new values.
+/// Returns false if the items do not fit; then the atlas is left unchanged.
+/// `flags` is a combination of `sma_repack_flags`.
+bool sma_atlas_repack(smol_atlas_t* atlas, smol_atlas_item_t** items, int count, int flags = 0, int new_width = 0, int new_height = 0);
+
+/// Item that was moved by a repack: new position is at `sma_item_x` / `sma_item_y`.
+struct smol_item_move_t
+{
+    smol_atlas_item_t* item;
+    int old_x;
+    int old_y;
+};
+
+/// Get the items that were moved by the last repack (sync or async). Returns their
+/// count, and `out_moves` (if not NULL) is set to the list, valid until next repack.
+int sma_atlas_repack_moves(const smol_atlas_t* atlas, const smol_item_move_t** out_moves);
+
+/// Start repacking the given items on a background thread (same as `sma_atlas_repack`
+/// otherwise). While that is in progress, the atlas can still be used as usual:
+/// items can be added and removed, in the current layout. Only one repack can be
+/// in progress at a time; returns false if another one is.
+bool sma_atlas_repack_async_begin(smol_atlas_t* atlas, smol_atlas_item_t** items, int count, int flags = 0, int new_width = 0, int new_height = 0);
+
+/// Is the background repack done, i.e. will `sma_atlas_repack_async_finish` not block?
+bool sma_atlas_repack_async_is_done(const smol_atlas_t* atlas);
+
+/// Finish the background repack (waiting for it if needed), and switch the atlas
+/// to the new layout in one go. Items removed in the meantime are left out; items
+/// added in the meantime are placed into the new layout.
+/// Returns the number of moved items, and `out_moves` (if not NULL) is set to
+/// the list of them, valid until next repack. Items added since the repack start
+/// are always in the list. Returns -1 if the new layout does not fit all the
+/// items (or no repack was in progress); then the atlas is left unchanged.
+int sma_atlas_repack_async_finish(smol_atlas_t* atlas, const smol_item_move_t** out_moves = nullptr);
+
+/// Item size, for `sma_atlas_find_min_size`.
+struct smol_item_size_t
+{
+    int width;
+    int height;
+};
+
+/// Atlas size constraints, for `sma_atlas_find_min_size`.
+struct smol_size_constraints_t
+{
+    int max_width = 16384;
+    int max_height = 16384;
+    /// Atlas width and height are multiples of this (unless power_of_two is set).
+    int size_step = 1;
+    /// Both atlas width and height have to be powers of two.
+    bool power_of_two = false;
+    /// Atlas has to be square.
+    bool square = false;
+    /// Maximum aspect ratio (larger side / smaller side); zero if no limit.
+    float max_aspect = 0.0f;
+    /// How many threads to use for the search; zero to use all cores.
+    int threads = 0;
+};
+
+/// Find the smallest (by area) atlas that fits all the given items, e.g. for offline
+/// baking of icon or font atlases. Creates and returns the atlas with the items
+/// added to it (`out_items[i]` is the atlas item for `items[i]`), or NULL if the
+/// items do not fit within the constraints (or there are no items). Constraints can
+/// be NULL for defaults.
+/// Candidate sizes are evaluated in parallel on multiple threads.
+smol_atlas_t* sma_atlas_find_min_size(const smol_item_size_t* items, int count, const smol_size_constraints_t* constraints, smol_atlas_item_t** out_items);
+
+/// Composite atlas: the atlas area split into horizontal bands ("regions") of full
+/// width, one per item height class, each being a separate `smol_atlas_t`. Items of
+/// different classes (e.g. glyphs and thumbnails) then never share shelves, and churn
+/// of one class does not fragment the others.
+struct smol_composite_t;
+
+/// Create a composite atlas of given size. `class_max_heights` are the tallest item
+/// heights of each of `class_count` size classes, in increasing order; items taller
+/// than the last one go into the last class. `flags` are used for all the regions.
+/// Regions start out empty, and are stacked top to bottom in class order.
+smol_composite_t* sma_composite_create(int width, int height, const int* class_max_heights, int class_count, int flags = 0);
+
+/// Destroy the composite atlas, along with all its regions.
+void sma_composite_destroy(smol_composite_t* comp);
+
+/// Add an item into the region of its height class. When that region is full, it is
+/// made taller by taking area that is not in any region yet, or the unused space at
+/// the bottom of other regions. That moves the regions in between (see
+/// `sma_composite_region_moves`), and all items within them. Returns NULL if there is no
+/// more space left.
+smol_atlas_item_t* sma_composite_item_add(smol_composite_t* comp, int width, int height);
+
+/// Region that was moved by growing another region: its items moved down or up by
+/// `new_y - old_y`, and their pixels need to be moved by that much too.
+struct smol_region_move_t
+{
+    int index;
+    int old_y;
+    int new_y;
+};
+
+/// Get the regions that were moved by the last `sma_composite_item_add`. Returns their
+/// count, and `out_moves` (if not NULL) is set to the list, valid until next add or clear.
+int sma_composite_region_moves(const smol_composite_t* comp, const smol_region_move_t** out_moves);
+
+/// Remove a previously added item from the composite atlas.
+void sma_composite_item_remove(smol_composite_t* comp, smol_atlas_item_t* item);
+
+/// Get item Y coordinate within the composite atlas. `sma_item_y` is the coordinate
+/// within its region; X coordinate is the same in both.
+int sma_composite_item_y(const smol_composite_t* comp, const smol_atlas_item_t* item);
+
+/// Get the number of regions, i.e. size classes.
+int sma_composite_region_count(const smol_composite_t* comp);
+
+/// Get region atlas of a size class. `out_y` (if not NULL) is set to its Y coordinate
+/// within the composite atlas. Regions can be repacked (without a new size) with the
+/// regular atlas functions, e.g. to compact them and leave more unused space for other
+/// regions; they must not be resized or cleared directly.
+smol_atlas_t* sma_composite_region(smol_composite_t* comp, int index, int* out_y = nullptr);
+
+/// Clear the composite atlas: all regions become empty. This invalidates any
+/// previously returned item pointers.
+void sma_composite_clear(smol_composite_t* comp);
+
+/// Pixel store formats, see `sma_atlas_attach_pixels`. Values are bytes per pixel.
+enum sma_pixel_format
+{
+    SMA_PIXELS_R8 = 1,
+    SMA_PIXELS_RG8 = 2,
+    SMA_PIXELS_RGBA8 = 4,
+    SMA_PIXELS_RGBA16F = 8,
+    SMA_PIXELS_RGBA32F = 16,
+};
+
+/// Attach a CPU side pixel store to the atlas: an image of atlas size in the given
+/// format, initially all zeros. Each image row starts at a multiple of `row_alignment`
+/// bytes (a power of two). From then on, pixels of items moved by repacks are moved
+/// along with them, and the image is resized with the atlas (new area is zeros).
+/// Clearing the atlas clears the image too. Replaces any previously attached store.
+void sma_atlas_attach_pixels(smol_atlas_t* atlas, sma_pixel_format format, int row_alignment = 1);
+
+/// Get pixel store image, or NULL if there is none. `out_row_pitch` (if not NULL) is
+/// set to distance between image rows in bytes. Returned pointer is valid until next
+/// repack or clear.
+void* sma_atlas_pixels(smol_atlas_t* atlas, int* out_row_pitch = nullptr);
+
+/// Copy item pixels into the pixel store, at item position. `pixels` is an image of
+/// item size in pixel store format; `row_pitch` is distance between its rows in bytes,
+/// zero for tightly packed rows. Does nothing if there is no pixel store.
+/// For rotated items, the image is in original (not rotated) orientation.
+void sma_item_write_pixels(smol_atlas_t* atlas, const smol_atlas_item_t* item, const void* pixels, int row_pitch = 0);
+
+/// Copy region of a batched upload, see `sma_upload_end`.
+struct smol_upload_region_t
+{
+    /// Offset of region pixels in the upload buffer, in bytes.
+    size_t offset;
+    /// Distance between region rows in the upload buffer, in bytes.
+    int row_pitch;
+    /// Destination rectangle in the atlas.
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+/// Start batching pixels of items for upload into a GPU texture, in the given format.
+/// Region rows and offsets in the upload buffer will be multiples of `row_alignment`
+/// bytes (a power of two), e.g. 256 for D3D12 texture copies.
+void sma_upload_begin(smol_atlas_t* atlas, sma_pixel_format format, int row_alignment = 1);
+
+/// Add item pixels to the upload batch. `pixels` is an image of item size, with
+/// `row_pitch` bytes between rows (zero for tightly packed rows); it is copied
+/// right away. Item must stay in the atlas until `sma_upload_end`.
+/// For rotated items, the image is in original (not rotated) orientation.
+void sma_upload_push(smol_atlas_t* atlas, const smol_atlas_item_t* item, const void* pixels, int row_pitch = 0);
+
+/// Finish the upload batch: pixels of all pushed items are put into one contiguous
+/// buffer, as a list of copy regions sorted by shelf. Items that are next to each
+/// other on the same shelf are merged into one region; the area below shorter items
+/// in a region is zeros (it is unused shelf space). Returns the region count, and
+/// sets the buffer, its size and the regions; these are valid until next `sma_upload_end`.
+int sma_upload_end(smol_atlas_t* atlas, const void** out_buffer, size_t* out_buffer_size, const smol_upload_region_t** out_regions);
+
+/// UV rectangle formats, see `sma_atlas_write_uvs`.
+enum sma_uv_format
+{
+    /// Four 32 bit floats per item.
+    SMA_UV_FLOAT32 = 0,
+    /// Four 16 bit unsigned normalized integers, i.e. 0..65535 for 0..1.
+    SMA_UV_UNORM16 = 1,
+    /// Four 16 bit half floats.
+    SMA_UV_HALF = 2,
+};
+
+/// Write UV rectangles of the given items, e.g. into a vertex or instance buffer: for
+/// each item, (left, top, right, bottom) coordinates divided by atlas size, in the given
+/// format. Rectangle of `items[i]` is written `i * stride` bytes into `out`; zero stride
+/// means tightly packed rectangles. Rectangles are in atlas space, i.e. for rotated
+/// items the image is rotated within them.
+void sma_atlas_write_uvs(const smol_atlas_t* atlas, const smol_atlas_item_t* const* items, int count, void* out, sma_uv_format format, int stride = 0);
+
 /// Get item X coordinate.
 int sma_item_x(const smol_atlas_item_t* item);
 /// Get item Y coordinate.
 int sma_item_y(const smol_atlas_item_t* item);
-/// Get item width.
+/// Get item width. For rotated items, this is width within the atlas, i.e. the original height.
 int sma_item_width(const smol_atlas_item_t* item);
-/// Get item height.
+/// Get item height. For rotated items, this is height within the atlas, i.e. the original width.
 int sma_item_height(const smol_atlas_item_t* item);
+/// Is the item placed rotated by 90 degrees clockwise? Only possible with `SMA_ATLAS_ROTATE`.
+bool sma_item_rotated(const smol_atlas_item_t* item);
+/// Set item user data: any 64 bit value, e.g. an ID or a pointer, for the application
+/// to find out what the item is for. It is zero for new items.
+void sma_item_set_user_data(smol_atlas_item_t* item, uint64_t data);
+/// Get item user data.
+uint64_t sma_item_user_data(const smol_atlas_item_t* item);
+/// Is the item pinned? See `sma_item_set_pinned`.
+bool sma_item_pinned(const smol_atlas_item_t* item);
+
+/// Item rectangle, see `sma_item_rect`.
+struct smol_item_rect_t
+{
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+/// Get item rectangle. When smol-atlas.cpp is compiled with SMOL_ATLAS_CONCURRENT_READS
+/// defined to 1, unlike the other item functions, this can be called from other threads
+/// while the atlas is being modified (items added and removed, repacks), without any
+/// locks: the result is always a consistent rectangle. Removed items then read as all
+/// zeros, until their memory is reused by new items; keep items alive while other
+/// threads can read them. Each item is updated on its own; use `sma_atlas_epoch` to
+/// read several items as of the same layout. Without that define, items do not keep
+/// the extra rectangle copy, and this is only safe on the thread modifying the atlas.
+smol_item_rect_t sma_item_rect(const smol_atlas_item_t* item);
+
+/// Get atlas layout epoch, for reading item rectangles from other threads in a
+/// "seqlock" way: the epoch is odd while a repack is updating item rectangles.
+/// Read the epoch, then the rectangles (`sma_item_rect`), then the epoch again;
+/// if it was odd or has changed, the rectangles can be from different layouts
+/// and should be read again.
+uint32_t sma_atlas_epoch(const smol_atlas_t* atlas);
+
+/// Shared atlas: a simpler atlas that lives entirely within a caller provided memory
+/// block, and has no pointers in it. The block can be in shared memory, mapped at
+/// different addresses in several processes, and all of them can add and remove items
+/// directly. Modifications are guarded by a spin lock within the block (a process that
+/// dies while holding it leaves the others blocked). Uses the same shelf packing as
+/// regular atlases, without slabs, rotation, sub-shelves, repacks or pixel stores. Items
+/// are referred to by integer handles; a handle can be reused by a new item once its
+/// item is removed.
+struct smol_shared_atlas_t;
+
+/// Get memory block size in bytes that is needed for a shared atlas of given height,
+/// with room for up to `max_items` items at once.
+size_t sma_shared_atlas_size(int height, int max_items);
+
+/// Create a shared atlas of given size within a memory block of `size` bytes (see
+/// `sma_shared_atlas_size`), aligned to at least 16 bytes. Call this once, in one
+/// process, before any other process attaches to it. Returns NULL if the block is
+/// too small. Nothing needs to be destroyed; just free the memory block when done.
+smol_shared_atlas_t* sma_shared_atlas_init(void* memory, size_t size, int width, int height, int max_items);
+
+/// Attach to a shared atlas that was created with `sma_shared_atlas_init`, possibly
+/// in another process and at another memory address. Returns NULL if the memory
+/// block does not contain a shared atlas.
+smol_shared_atlas_t* sma_shared_atlas_attach(void* memory);
+
+/// Get shared atlas width.
+int sma_shared_atlas_width(const smol_shared_atlas_t* atlas);
+
+/// Get shared atlas height.
+int sma_shared_atlas_height(const smol_shared_atlas_t* atlas);
+
+/// Get the number of items in the shared atlas.
+int sma_shared_atlas_item_count(smol_shared_atlas_t* atlas);
+
+/// Clear the shared atlas. This invalidates all item handles.
+void sma_shared_atlas_clear(smol_shared_atlas_t* atlas);
+
+/// Add an item of (width x height) size into the shared atlas. Returns item handle,
+/// or -1 if there is no more space left (or `max_items` items are in the atlas).
+int sma_shared_item_add(smol_shared_atlas_t* atlas, int width, int height);
+
+/// Remove a previously added item from the shared atlas.
+void sma_shared_item_remove(smol_shared_atlas_t* atlas, int item);
+
+/// Get item rectangle. Returns false if there is no such item.
+bool sma_shared_item_rect(smol_shared_atlas_t* atlas, int item, smol_item_rect_t* out_rect);
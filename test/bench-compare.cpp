@@ -0,0 +1,390 @@
+// SPDX-License-Identifier: MIT OR Unlicense
+// smol-atlas: https://github.com/aras-p/smol-atlas
+
+// Comparison of two benchmark result files, as written by `smol-atlas -json file`:
+//
+// { "version": 1, "repeat": 5, "results": [
+//   { "data": "gold", "library": "smol-atlas", "gcs": 695, "repacks": 95, ...,
+//     "times_ms": [24.1, 24.3, ...] },
+//   ... ] }
+//
+// Packing metrics and allocation counts are deterministic, so any change of them
+// is reported. Timings are noisy; a time change is only flagged when the
+// Mann-Whitney U test says the two sets of run times are different (p < 0.05),
+// and the median changed by at least the given threshold (5% by default).
+// Runs on a busy or thermally throttling machine drift more than that between
+// invocations, so for a performance gate, run both on one thread (`-j 1`).
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+static constexpr double TIME_P_THRESHOLD = 0.05;
+static constexpr int MANN_WHITNEY_EXACT_MAX_N = 20;
+
+// -------------------------------------------------------------------
+// Minimal JSON reader, enough for the result files.
+
+struct JsonValue {
+    enum Type { Null, Bool, Number, String, Array, Object };
+    Type type = Null;
+    double number = 0.0;
+    std::string str;
+    std::vector<JsonValue> items;
+    std::vector<std::pair<std::string, JsonValue>> members;
+
+    const JsonValue* find(const char* key) const
+    {
+        for (const auto& m : members)
+            if (m.first == key)
+                return &m.second;
+        return nullptr;
+    }
+    double get_number(const char* key) const
+    {
+        const JsonValue* v = find(key);
+        return v && v->type == Number ? v->number : 0.0;
+    }
+    std::string get_string(const char* key) const
+    {
+        const JsonValue* v = find(key);
+        return v && v->type == String ? v->str : std::string();
+    }
+};
+
+struct JsonParser {
+    const char* p;
+
+    void skip_space()
+    {
+        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+            ++p;
+    }
+    bool parse_string(std::string& out)
+    {
+        if (*p != '"')
+            return false;
+        ++p;
+        while (*p && *p != '"') {
+            if (*p == '\\') {
+                ++p;
+                switch (*p) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u': // non-ASCII is not needed here, keep as is
+                    out += "\\u";
+                    break;
+                case 0: return false;
+                default: out += *p; break;
+                }
+                ++p;
+            }
+            else {
+                out += *p++;
+            }
+        }
+        if (*p != '"')
+            return false;
+        ++p;
+        return true;
+    }
+    bool parse_value(JsonValue& v)
+    {
+        skip_space();
+        if (*p == '{') {
+            v.type = JsonValue::Object;
+            ++p;
+            skip_space();
+            if (*p == '}') {
+                ++p;
+                return true;
+            }
+            while (true) {
+                skip_space();
+                std::string key;
+                if (!parse_string(key))
+                    return false;
+                skip_space();
+                if (*p++ != ':')
+                    return false;
+                v.members.emplace_back(key, JsonValue());
+                if (!parse_value(v.members.back().second))
+                    return false;
+                skip_space();
+                if (*p == ',') {
+                    ++p;
+                    continue;
+                }
+                if (*p++ != '}')
+                    return false;
+                return true;
+            }
+        }
+        if (*p == '[') {
+            v.type = JsonValue::Array;
+            ++p;
+            skip_space();
+            if (*p == ']') {
+                ++p;
+                return true;
+            }
+            while (true) {
+                v.items.emplace_back();
+                if (!parse_value(v.items.back()))
+                    return false;
+                skip_space();
+                if (*p == ',') {
+                    ++p;
+                    continue;
+                }
+                if (*p++ != ']')
+                    return false;
+                return true;
+            }
+        }
+        if (*p == '"') {
+            v.type = JsonValue::String;
+            return parse_string(v.str);
+        }
+        if (strncmp(p, "true", 4) == 0 || strncmp(p, "false", 5) == 0) {
+            v.type = JsonValue::Bool;
+            v.number = *p == 't' ? 1.0 : 0.0;
+            p += *p == 't' ? 4 : 5;
+            return true;
+        }
+        if (strncmp(p, "null", 4) == 0) {
+            p += 4;
+            return true;
+        }
+        char* end = nullptr;
+        v.type = JsonValue::Number;
+        v.number = strtod(p, &end);
+        if (end == p)
+            return false;
+        p = end;
+        return true;
+    }
+};
+
+static bool read_json_file(const char* filename, JsonValue& root)
+{
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+        printf("ERROR: could not open results file '%s'\n", filename);
+        return false;
+    }
+    std::string text;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        text.append(buf, n);
+    fclose(f);
+
+    JsonParser parser = { text.c_str() };
+    if (!parser.parse_value(root) || root.type != JsonValue::Object) {
+        printf("ERROR: could not parse results file '%s'\n", filename);
+        return false;
+    }
+    return true;
+}
+
+// -------------------------------------------------------------------
+
+struct BenchRecord {
+    std::string data;
+    std::string library;
+    const JsonValue* json;
+    std::vector<double> times;
+};
+
+static bool read_bench_records(const char* filename, JsonValue& root, std::vector<BenchRecord>& records)
+{
+    if (!read_json_file(filename, root))
+        return false;
+    const JsonValue* results = root.find("results");
+    if (!results || results->type != JsonValue::Array) {
+        printf("ERROR: no results in file '%s'\n", filename);
+        return false;
+    }
+    for (const JsonValue& res : results->items) {
+        BenchRecord rec;
+        rec.data = res.get_string("data");
+        rec.library = res.get_string("library");
+        rec.json = &res;
+        if (const JsonValue* times = res.find("times_ms")) {
+            for (const JsonValue& t : times->items)
+                rec.times.push_back(t.number);
+        }
+        std::sort(rec.times.begin(), rec.times.end());
+        records.emplace_back(rec);
+    }
+    return true;
+}
+
+static double median(const std::vector<double>& v)
+{
+    if (v.empty())
+        return 0.0;
+    size_t n = v.size();
+    return n & 1 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) * 0.5;
+}
+
+// Two-sided p-value of the Mann-Whitney U test, i.e. how likely it is to get
+// sample sets this different if they were from the same distribution. Exact
+// distribution for small sets, normal approximation for larger ones.
+static double mann_whitney_p(const std::vector<double>& a, const std::vector<double>& b)
+{
+    const int n = (int)a.size();
+    const int m = (int)b.size();
+    if (n == 0 || m == 0)
+        return 1.0;
+    // U statistic, doubled to keep ties (counted as half) integer
+    int u2 = 0;
+    for (double x : a)
+        for (double y : b)
+            u2 += x > y ? 2 : (x == y ? 1 : 0);
+    const int nm = n * m;
+
+    if (n <= MANN_WHITNEY_EXACT_MAX_N && m <= MANN_WHITNEY_EXACT_MAX_N) {
+        // count[i][j][u]: number of orderings of i+j samples with U = u;
+        // count(i,j,u) = count(i-1,j,u-j) + count(i,j-1,u)
+        const int stride_j = nm + 1;
+        const int stride_i = (m + 1) * stride_j;
+        std::vector<double> count((n + 1) * stride_i, 0.0);
+        for (int i = 0; i <= n; ++i) {
+            for (int j = 0; j <= m; ++j) {
+                double* c = &count[i * stride_i + j * stride_j];
+                if (i == 0 || j == 0) {
+                    c[0] = 1.0;
+                    continue;
+                }
+                const double* c_i = &count[(i - 1) * stride_i + j * stride_j];
+                const double* c_j = &count[i * stride_i + (j - 1) * stride_j];
+                for (int u = 0; u <= i * j; ++u)
+                    c[u] = (u >= j ? c_i[u - j] : 0.0) + c_j[u];
+            }
+        }
+        const double* c = &count[n * stride_i + m * stride_j];
+        double total = 0.0, below = 0.0, above = 0.0;
+        // with a tie (half U), be conservative and include the nearest values on both sides
+        const int u_lo = u2 / 2, u_hi = (u2 + 1) / 2;
+        for (int u = 0; u <= nm; ++u) {
+            total += c[u];
+            if (u <= u_hi)
+                below += c[u];
+            if (u >= u_lo)
+                above += c[u];
+        }
+        return std::min(1.0, 2.0 * std::min(below, above) / total);
+    }
+
+    const double u = u2 * 0.5;
+    const double mean = nm * 0.5;
+    const double sigma = sqrt(nm * (n + m + 1) / 12.0);
+    const double z = (fabs(u - mean) - 0.5) / sigma;
+    return std::min(1.0, erfc(std::max(z, 0.0) / sqrt(2.0)));
+}
+
+struct CompareStats {
+    int regressions = 0;
+    int improvements = 0;
+};
+
+// Report a change of a deterministic metric; `lower_is_better` tells which way is a regression.
+static void compare_metric(const BenchRecord& base, const BenchRecord& cur, const char* key, bool lower_is_better, std::string& report, CompareStats& stats)
+{
+    const double a = base.json->get_number(key);
+    const double b = cur.json->get_number(key);
+    if (a == b || fabs(a - b) < 1.0e-3)
+        return;
+    const bool better = lower_is_better ? b < a : b > a;
+    if (better)
+        ++stats.improvements;
+    else
+        ++stats.regressions;
+    char buf[200];
+    snprintf(buf, sizeof(buf), "  %-12s %12.6g -> %-12.6g %+7.1f%%  %s\n",
+             key, a, b, a != 0.0 ? (b - a) * 100.0 / fabs(a) : 100.0, better ? "better" : "WORSE");
+    report += buf;
+}
+
+static void compare_time(const BenchRecord& base, const BenchRecord& cur, double min_change, std::string& report, CompareStats& stats)
+{
+    const double a = median(base.times);
+    const double b = median(cur.times);
+    if (a <= 0.0 || b <= 0.0)
+        return;
+    const double change = (b - a) / a;
+    const double p = mann_whitney_p(base.times, cur.times);
+    const bool enough_runs = base.times.size() >= 4 && cur.times.size() >= 4;
+    const bool significant = enough_runs && p < TIME_P_THRESHOLD && fabs(change) >= min_change;
+    const char* verdict = "";
+    if (significant) {
+        verdict = change < 0.0 ? "better" : "WORSE";
+        if (change < 0.0)
+            ++stats.improvements;
+        else
+            ++stats.regressions;
+    }
+    else if (!enough_runs && fabs(change) >= min_change)
+        verdict = "(not tested, too few runs)";
+    else
+        return;
+    char buf[200];
+    snprintf(buf, sizeof(buf), "  %-12s %12.2f -> %-12.2f %+7.1f%%  %s (p=%.3f)\n",
+             "time_ms", a, b, change * 100.0, verdict, p);
+    report += buf;
+}
+
+int run_bench_compare(const char* base_filename, const char* new_filename, double min_time_change)
+{
+    JsonValue base_root, new_root;
+    std::vector<BenchRecord> base_records, new_records;
+    if (!read_bench_records(base_filename, base_root, base_records) ||
+        !read_bench_records(new_filename, new_root, new_records))
+        return 2;
+
+    printf("Comparing '%s' (%i runs per job) to '%s' (%i runs per job)\n",
+           base_filename, (int)base_root.get_number("repeat"),
+           new_filename, (int)new_root.get_number("repeat"));
+
+    CompareStats stats;
+    int unchanged = 0, missing = 0;
+    for (const BenchRecord& cur : new_records) {
+        auto it = std::find_if(base_records.begin(), base_records.end(), [&](const BenchRecord& r) {
+            return r.data == cur.data && r.library == cur.library;
+        });
+        if (it == base_records.end()) {
+            printf("%s / %s: not in base results\n", cur.data.c_str(), cur.library.c_str());
+            ++missing;
+            continue;
+        }
+        const BenchRecord& base = *it;
+        std::string report;
+        compare_time(base, cur, min_time_change, report, stats);
+        compare_metric(base, cur, "allocs", true, report, stats);
+        compare_metric(base, cur, "gcs", true, report, stats);
+        compare_metric(base, cur, "repacks", true, report, stats);
+        compare_metric(base, cur, "moved_pixels", true, report, stats);
+        compare_metric(base, cur, "width", true, report, stats);
+        compare_metric(base, cur, "height", true, report, stats);
+        compare_metric(base, cur, "used", false, report, stats);
+        if (report.empty()) {
+            ++unchanged;
+            continue;
+        }
+        printf("%s / %s:\n%s", cur.data.c_str(), cur.library.c_str(), report.c_str());
+    }
+    printf("%i regressions, %i improvements, %i jobs unchanged, %i not in base\n",
+           stats.regressions, stats.improvements, unchanged, missing);
+    return stats.regressions > 0 ? 1 : 0;
+}
@@ -4,12 +4,29 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
-#include <time.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <new>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #define TEST_ON_MAPBOX 1
 #define TEST_ON_ETAGERE (HAVE_ETAGERE && 1)
 #define TEST_ON_STB_RECTPACK 1
@@ -32,7 +49,8 @@ static constexpr int TEST_DATA_GC_AFTER_FRAMES = 2;
 // -------------------------------------------------------------------
 
 // https://www.reedbeta.com/blog/hash-functions-for-gpu-rendering/
-static uint32_t pcg_state;
+// (thread local, since benchmark jobs can run on multiple threads)
+static thread_local uint32_t pcg_state;
 
 static uint32_t pcg32()
 {
@@ -44,33 +62,139 @@ static uint32_t pcg32()
 
 // -------------------------------------------------------------------
 
+// Count heap allocations made on the current thread, to report allocation
+// counts of each benchmark job. All the operator new / delete variants are
+// replaced, so that every allocation goes through these and gets freed by
+// a matching function. Aligned allocations keep the malloc pointer right
+// before the aligned block.
+static thread_local size_t alloc_count;
+
+static void* counted_alloc(size_t size, size_t align)
+{
+    ++alloc_count;
+    if (align <= alignof(std::max_align_t))
+        return malloc(size ? size : 1);
+    void* raw = malloc(size + align + sizeof(void*));
+    if (!raw)
+        return nullptr;
+    void* ptr = (void*)((uintptr_t(raw) + sizeof(void*) + align - 1) & ~uintptr_t(align - 1));
+    ((void**)ptr)[-1] = raw;
+    return ptr;
+}
+
+static void counted_free(void* ptr, size_t align)
+{
+    if (ptr && align > alignof(std::max_align_t))
+        ptr = ((void**)ptr)[-1];
+    free(ptr);
+}
+
+static void* counted_alloc_or_throw(size_t size, size_t align)
+{
+    void* ptr = counted_alloc(size, align);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new(size_t size) { return counted_alloc_or_throw(size, 0); }
+void* operator new[](size_t size) { return counted_alloc_or_throw(size, 0); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return counted_alloc(size, 0); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return counted_alloc(size, 0); }
+void* operator new(size_t size, std::align_val_t align) { return counted_alloc_or_throw(size, size_t(align)); }
+void* operator new[](size_t size, std::align_val_t align) { return counted_alloc_or_throw(size, size_t(align)); }
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return counted_alloc(size, size_t(align)); }
+void* operator new[](size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return counted_alloc(size, size_t(align)); }
+
+void operator delete(void* ptr) noexcept { counted_free(ptr, 0); }
+void operator delete[](void* ptr) noexcept { counted_free(ptr, 0); }
+void operator delete(void* ptr, size_t) noexcept { counted_free(ptr, 0); }
+void operator delete[](void* ptr, size_t) noexcept { counted_free(ptr, 0); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { counted_free(ptr, 0); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { counted_free(ptr, 0); }
+void operator delete(void* ptr, std::align_val_t align) noexcept { counted_free(ptr, size_t(align)); }
+void operator delete[](void* ptr, std::align_val_t align) noexcept { counted_free(ptr, size_t(align)); }
+void operator delete(void* ptr, size_t, std::align_val_t align) noexcept { counted_free(ptr, size_t(align)); }
+void operator delete[](void* ptr, size_t, std::align_val_t align) noexcept { counted_free(ptr, size_t(align)); }
+void operator delete(void* ptr, std::align_val_t align, const std::nothrow_t&) noexcept { counted_free(ptr, size_t(align)); }
+void operator delete[](void* ptr, std::align_val_t align, const std::nothrow_t&) noexcept { counted_free(ptr, size_t(align)); }
+
+// -------------------------------------------------------------------
+
 struct TestEntry {
     int id;
     int width;
     int height;
 };
-static std::vector<TestEntry> s_unique_entries;
-static HASHTABLE_TYPE<std::string, int> s_entry_map;
-static std::vector<int> s_test_entries;
-static std::vector<std::pair<int, int>> s_test_frames;
 
-static void clear_test_data()
-{
-    s_unique_entries.clear();
-    s_entry_map.clear();
-    s_test_entries.clear();
-    s_test_frames.clear();
-}
+// Synthetic workload: item size distribution, plus how the set of items changes
+// over time. Initially `init_count` items are added; then in each of `run_count`
+// loops some items are removed and `init_count * (churn + growth)` new ones added.
+// Without a lifetime, each item is removed with `churn` probability per loop;
+// with a lifetime, items are removed once they are that many loops old.
+enum class SyntheticSizes {
+    Uniform,
+    Glyph,
+    Thumbnail,
+    Icon,
+    Adversarial,
+};
+
+struct SyntheticWorkload {
+    const char* name;
+    const char* description;
+    SyntheticSizes sizes;
+    int init_count;
+    int run_count;
+    float churn;
+    float growth;
+    int lifetime;
+};
+
+static const SyntheticWorkload k_synthetic_workloads[] = {
+    { "uniform", "Synthetic: uniform sizes 1..128, 30% churn", SyntheticSizes::Uniform, 2000, 50, 0.3f, 0.0f, 0 },
+    { "glyph", "Synthetic: glyphs 3..24 x 14..18, 20% churn, growing", SyntheticSizes::Glyph, 4000, 50, 0.2f, 0.01f, 0 },
+    { "thumbnail", "Synthetic: thumbnails 32..192 x 64, live for 4 loops", SyntheticSizes::Thumbnail, 1500, 50, 0.25f, 0.0f, 4 },
+    { "icon", "Synthetic: icons of a few square sizes 16..128, 10% churn", SyntheticSizes::Icon, 1500, 50, 0.1f, 0.0f, 0 },
+    { "adversarial", "Synthetic: adversarial thin/flat/huge mix, 40% churn, growing", SyntheticSizes::Adversarial, 1500, 50, 0.4f, 0.02f, 0 },
+};
+
+struct TestData {
+    std::string name;
+    std::string description;
+    const SyntheticWorkload* workload = nullptr; // synthetic test if set
+    std::vector<TestEntry> unique_entries;
+    std::vector<int> test_entries;
+    std::vector<std::pair<int, int>> test_frames;
+};
 
-static void load_test_data(const char* filename)
+struct TestResult {
+    int end_items = 0;
+    int insertions = 0;
+    int removals = 0;
+    int gcs = 0;
+    int repacks = 0;
+    int repack_calls = 0;
+    size_t moved_pixels = 0; // total area of items that were moved by repacks
+    size_t allocs = 0; // heap allocations during the test
+    int width = 0;
+    int height = 0;
+    size_t entry_total = 0;
+    double time_ms = 0.0;
+};
+
+static void load_test_data(const char* data_name, TestData& data)
 {
-    clear_test_data();
+    data = TestData();
+    data.name = data_name;
+    const std::string filename = std::string("test/thumbs-") + data_name + ".txt";
 
-    FILE* f = fopen(filename, "rt");
+    FILE* f = fopen(filename.c_str(), "rt");
     if (!f) {
-        printf("ERROR: could not open test file '%s'\n", filename);
+        printf("ERROR: could not open test file '%s'\n", filename.c_str());
         exit(1);
     }
+    HASHTABLE_TYPE<std::string, int> entry_map;
     char buf[1000];
     int frame_start_idx = -1;
     while (fgets(buf, sizeof(buf)-1, f) != NULL) {
@@ -80,33 +204,34 @@ static void load_test_data(const char* filename)
 
         if (sscanf(buf, "FRAME %i", &frame) == 1) {
             if (frame_start_idx >= 0)
-                s_test_frames.push_back(std::make_pair(frame_start_idx, (int)s_test_entries.size() - frame_start_idx));
-            frame_start_idx = (int)s_test_entries.size();
+                data.test_frames.push_back(std::make_pair(frame_start_idx, (int)data.test_entries.size() - frame_start_idx));
+            frame_start_idx = (int)data.test_entries.size();
         }
         else if (sscanf(buf, "img %lli %i %i crop %i %i %i %i %i", &ptr, &width, &height, &crop, &minx, &miny, &maxx, &maxy) == 8) {
             std::string strbuf = buf;
             int id;
-            auto it = s_entry_map.find(strbuf);
-            if (it == s_entry_map.end()) {
-                id = (int)s_entry_map.size();
-                s_entry_map.insert(std::make_pair(strbuf, id));
-                s_unique_entries.push_back({id, maxx+1, maxy+1});
+            auto it = entry_map.find(strbuf);
+            if (it == entry_map.end()) {
+                id = (int)entry_map.size();
+                entry_map.insert(std::make_pair(strbuf, id));
+                data.unique_entries.push_back({id, maxx+1, maxy+1});
             }
             else {
                 id = it->second;
             }
-            s_test_entries.push_back(id);
+            data.test_entries.push_back(id);
         }
         else {
             break;
         }
     }
     if (frame_start_idx >= 0)
-        s_test_frames.push_back(std::make_pair(frame_start_idx, (int)s_test_entries.size() - frame_start_idx));
+        data.test_frames.push_back(std::make_pair(frame_start_idx, (int)data.test_entries.size() - frame_start_idx));
     fclose(f);
-    printf("'%s': %i frames; %i unique %i total items, %i runs\n",
-        filename, int(s_test_frames.size()), int(s_unique_entries.size()), int(s_test_entries.size()), TEST_DATA_RUN_COUNT);
-    printf("Library        EndItems Adds   Rems   GCs  Repacks AtlasSize MPix Used%% TimeMS\n");
+    char desc[1000];
+    snprintf(desc, sizeof(desc), "'%s': %i frames; %i unique %i total items, %i runs",
+        filename.c_str(), int(data.test_frames.size()), int(data.unique_entries.size()), int(data.test_entries.size()), TEST_DATA_RUN_COUNT);
+    data.description = desc;
 }
 
 
@@ -168,22 +293,32 @@ size_t count_total_entries_size(T& atlas, const HASHTABLE_TYPE<int, typename T::
     return total;
 }
 
+// libraries that can repack their items in place provide their own grow_and_repack
+template<typename T, typename = void> struct has_grow_and_repack : std::false_type {};
+template<typename T> struct has_grow_and_repack<T, std::void_t<decltype(&T::grow_and_repack)>> : std::true_type {};
+
+// returns number of repack iterations; adds area of items that changed position to moved_pixels
 template<typename T>
-int grow_atlas_and_repack(T& atlas, HASHTABLE_TYPE<int, typename T::Entry>& entries, int e_id, int e_width, int e_height)
+int grow_atlas_and_repack(T& atlas, HASHTABLE_TYPE<int, typename T::Entry>& entries, int e_id, int e_width, int e_height, size_t& moved_pixels)
 {
+    if constexpr (has_grow_and_repack<T>::value)
+        return atlas.grow_and_repack(entries, e_id, e_width, e_height, moved_pixels);
+
     struct EntryInfo {
         int id;
         int w;
         int h;
+        int x;
+        int y;
     };
     std::vector<EntryInfo> infos;
     infos.reserve(entries.size() + 1);
     for (const auto& kvp : entries) {
-        EntryInfo i{kvp.first, atlas.entry_width(kvp.second), atlas.entry_height(kvp.second) };
+        EntryInfo i{kvp.first, atlas.entry_width(kvp.second), atlas.entry_height(kvp.second), atlas.entry_x(kvp.second), atlas.entry_y(kvp.second) };
         infos.emplace_back(i);
     }
     // make sure to include the entry that caused out of space condition in the caller
-    infos.emplace_back(EntryInfo{e_id, e_width, e_height});
+    infos.emplace_back(EntryInfo{e_id, e_width, e_height, -1, -1});
     
     // sort repacked entries by decreasing height, improves behavior of most (all?) libraries
     std::sort(infos.begin(), infos.end(), [](const EntryInfo& a, const EntryInfo& b) {
@@ -219,8 +354,14 @@ int grow_atlas_and_repack(T& atlas, HASHTABLE_TYPE<int, typename T::Entry>& entr
             assert(atlas.entry_valid(res));
             entries.insert({i.id, res});
         }
-        if (!failed)
+        if (!failed) {
+            for (const auto& i : infos) {
+                const typename T::Entry& res = entries[i.id];
+                if (i.x >= 0 && (atlas.entry_x(res) != i.x || atlas.entry_y(res) != i.y))
+                    moved_pixels += size_t(i.w) * i.h;
+            }
             return iterations;
+        }
         
         // Failed packing into current atlas size, increase it.
         ++iterations;
@@ -234,28 +375,30 @@ int grow_atlas_and_repack(T& atlas, HASHTABLE_TYPE<int, typename T::Entry>& entr
 }
 
 template<typename T>
-static void test_atlas_on_data(const char* name, const char* dumpname)
+static TestResult test_atlas_on_data(const TestData& data, const char* name, const char* dumpname)
 {
-    printf("%14s ", name);
-    clock_t t0 = clock();
+    auto t0 = std::chrono::steady_clock::now();
+    const size_t allocs0 = alloc_count;
     T atlas(ATLAS_SIZE_INIT, ATLAS_SIZE_INIT);
 
-    std::vector<int> id_to_timestamp(s_unique_entries.size(), -TEST_DATA_GC_AFTER_FRAMES);
+    std::vector<int> id_to_timestamp(data.unique_entries.size(), -TEST_DATA_GC_AFTER_FRAMES);
     HASHTABLE_TYPE<int, typename T::Entry> live_entries;
     
     int insertions = 0;
     int removals = 0;
     int timestamp = 0;
     int repacks = 0;
+    int repack_calls = 0;
+    size_t moved_pixels = 0;
     int gcs = 0;
     for (int run = 0; run < TEST_DATA_RUN_COUNT; ++run) {
-        for (int frame_idx = 0; frame_idx < s_test_frames.size(); ++frame_idx) {
-            size_t frame_start_idx = s_test_frames[frame_idx].first;
-            size_t frame_size = s_test_frames[frame_idx].second;
+        for (int frame_idx = 0; frame_idx < data.test_frames.size(); ++frame_idx) {
+            size_t frame_start_idx = data.test_frames[frame_idx].first;
+            size_t frame_size = data.test_frames[frame_idx].second;
 
             // process frame data for which entries are visible
             for (size_t test_idx = frame_start_idx; test_idx < frame_start_idx + frame_size; ++test_idx) {
-                const TestEntry& test_entry = s_unique_entries[s_test_entries[test_idx]];
+                const TestEntry& test_entry = data.unique_entries[data.test_entries[test_idx]];
                 id_to_timestamp[test_entry.id] = timestamp;
 
                 auto it = live_entries.find(test_entry.id);
@@ -297,73 +440,129 @@ static void test_atlas_on_data(const char* name, const char* dumpname)
                 }
 
                 // still could not fit it, have to repack and/or grow the atlas
-                repacks += grow_atlas_and_repack(atlas, live_entries, test_entry.id, test_entry.width, test_entry.height);
+                ++repack_calls;
+                repacks += grow_atlas_and_repack(atlas, live_entries, test_entry.id, test_entry.width, test_entry.height, moved_pixels);
             }
 
             ++timestamp;
         }
     }
 
-    clock_t t1 = clock();
-    double dur = (t1 - t0) / double(CLOCKS_PER_SEC);
-    
-    int width = atlas.width();
-    int height = atlas.height();
-    size_t entry_total = count_total_entries_size(atlas, live_entries);
-    printf("%8i %6i %6i %4i %7i %ix%i %4.1f %5.1f %6.1f\n",
-           (int)live_entries.size(), insertions, removals, gcs, repacks,
-           width, height, width * height / 1.0e6,
-           entry_total * 100.0 / (width * height),
-           dur * 1000.0);
-    
-    dump_to_svg(atlas, live_entries, dumpname, name);
+    auto t1 = std::chrono::steady_clock::now();
+    const size_t allocs1 = alloc_count;
+
+    TestResult res;
+    res.end_items = (int)live_entries.size();
+    res.insertions = insertions;
+    res.removals = removals;
+    res.gcs = gcs;
+    res.repacks = repacks;
+    res.repack_calls = repack_calls;
+    res.moved_pixels = moved_pixels;
+    res.allocs = allocs1 - allocs0;
+    res.width = atlas.width();
+    res.height = atlas.height();
+    res.entry_total = count_total_entries_size(atlas, live_entries);
+    res.time_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+    if (dumpname)
+        dump_to_svg(atlas, live_entries, dumpname, name);
+    return res;
 }
 
 static int rand_size() { return ((pcg32() & 127) + 1); } // up to 128
+static int rand_range(int lo, int hi) { return lo + (int)(pcg32() % (uint32_t)(hi - lo + 1)); }
+
+static void synthetic_item_size(const SyntheticWorkload& wl, int& w, int& h)
+{
+    switch (wl.sizes) {
+    case SyntheticSizes::Uniform:
+        w = rand_size();
+        h = rand_size();
+        break;
+    case SyntheticSizes::Glyph:
+        // many small items of nearly the same height
+        w = rand_range(3, 24);
+        h = rand_range(14, 18);
+        break;
+    case SyntheticSizes::Thumbnail:
+        // fixed height, variable width
+        w = rand_range(32, 192);
+        h = 64;
+        break;
+    case SyntheticSizes::Icon: {
+        // a few discrete square sizes, smaller ones more common
+        static const int k_sizes[] = { 16, 16, 16, 24, 24, 32, 32, 48, 64, 128 };
+        w = h = k_sizes[pcg32() % (sizeof(k_sizes) / sizeof(k_sizes[0]))];
+        break;
+    }
+    case SyntheticSizes::Adversarial: {
+        // thin tall, wide flat, tiny and occasional huge items mixed together
+        const uint32_t kind = pcg32() % 16;
+        if (kind < 5) { w = rand_range(1, 8); h = rand_range(64, 256); }
+        else if (kind < 10) { w = rand_range(64, 256); h = rand_range(1, 8); }
+        else if (kind < 15) { w = rand_range(1, 16); h = rand_range(1, 16); }
+        else { w = rand_range(128, 400); h = rand_range(128, 400); }
+        break;
+    }
+    }
+}
 
 template<typename T>
-static void test_atlas_synthetic(const char* name, const char* dumpname)
+static TestResult test_atlas_synthetic(const TestData& data, const char* name, const char* dumpname)
 {
-    printf("%14s ", name);
-    clock_t t0 = clock();
+    const SyntheticWorkload& wl = *data.workload;
+    auto t0 = std::chrono::steady_clock::now();
+    const size_t allocs0 = alloc_count;
     T atlas(ATLAS_SIZE_INIT, ATLAS_SIZE_INIT);
     
-    constexpr int INIT_ENTRY_COUNT = 2000;
-    constexpr int LOOP_RUN_COUNT = 50;
-    constexpr float LOOP_FRACTION = 0.3f;
-    
     pcg_state = 1;
 
     int insertions = 0;
     int removals = 0;
     int id_counter = 1;
     HASHTABLE_TYPE<int, typename T::Entry> entries;
+    std::vector<int> id_to_birth(1, 0); // loop run when an entry was added
     int repacks = 0;
+    int repack_calls = 0;
+    size_t moved_pixels = 0;
 
-    // insert a bunch of initial entries
-    for (int i = 0; i < INIT_ENTRY_COUNT; ++i) {
-        int w = rand_size();
-        int h = rand_size();
+    auto add_entry = [&](int run) {
+        int w, h;
+        synthetic_item_size(wl, w, h);
         int id = id_counter++;
-
+        id_to_birth.push_back(run);
         typename T::Entry res = atlas.pack(w, h);
         ++insertions;
         if (atlas.entry_valid(res)) {
             entries.insert({id, res});
         }
         else {
-            repacks += grow_atlas_and_repack(atlas, entries, id, w, h);
+            ++repack_calls;
+            repacks += grow_atlas_and_repack(atlas, entries, id, w, h, moved_pixels);
         }
-    }
+    };
+
+    // insert a bunch of initial entries
+    for (int i = 0; i < wl.init_count; ++i)
+        add_entry(0);
     
     // run removal/insertion loops
-    for (int run = 0; run < LOOP_RUN_COUNT; ++run) {
+    const int adds_per_run = int(wl.init_count * (wl.churn + wl.growth));
+    for (int run = 0; run < wl.run_count; ++run) {
         
-        // remove a bunch of entries
+        // remove a bunch of entries: those that are old enough, or random ones
         for (auto it = entries.begin(); it != entries.end(); ) {
             assert(atlas.entry_valid(it->second));
-            float rnd = (pcg32() & 1023) / 1024.0f;
-            if (rnd < LOOP_FRACTION) {
+            bool remove;
+            if (wl.lifetime > 0) {
+                remove = run - id_to_birth[it->first] >= wl.lifetime;
+            }
+            else {
+                float rnd = (pcg32() & 1023) / 1024.0f;
+                remove = rnd < wl.churn;
+            }
+            if (remove) {
                 atlas.release(it->second);
                 ++removals;
                 it = entries.erase(it);
@@ -374,35 +573,30 @@ static void test_atlas_synthetic(const char* name, const char* dumpname)
         }
         
         // add a bunch of entries
-        for (int i = 0; i < INIT_ENTRY_COUNT * LOOP_FRACTION; ++i) {
-            int w = rand_size();
-            int h = rand_size();
-            int id = id_counter++;
-            typename T::Entry res = atlas.pack(w, h);
-            ++insertions;
-            if (atlas.entry_valid(res)) {
-                entries.insert({id, res});
-            }
-            else {
-                repacks += grow_atlas_and_repack(atlas, entries, id, w, h);
-            }
-        }
+        for (int i = 0; i < adds_per_run; ++i)
+            add_entry(run);
     }
     
-    clock_t t1 = clock();
-    double dur = (t1 - t0) / double(CLOCKS_PER_SEC);
-    
-    int width = atlas.width();
-    int height = atlas.height();
-    size_t entry_total = count_total_entries_size(atlas, entries);
-    printf("%8i %6i %6i %4i %7i %ix%i %4.1f %5.1f %6.1f\n",
-           (int)entries.size(), insertions, removals, 0, repacks,
-           width, height, width * height / 1.0e6,
-           entry_total * 100.0 / (width * height),
-           dur * 1000.0);
-
-
-    dump_to_svg(atlas, entries, dumpname, name);
+    auto t1 = std::chrono::steady_clock::now();
+    const size_t allocs1 = alloc_count;
+
+    TestResult res;
+    res.end_items = (int)entries.size();
+    res.insertions = insertions;
+    res.removals = removals;
+    res.gcs = 0;
+    res.repacks = repacks;
+    res.repack_calls = repack_calls;
+    res.moved_pixels = moved_pixels;
+    res.allocs = allocs1 - allocs0;
+    res.width = atlas.width();
+    res.height = atlas.height();
+    res.entry_total = count_total_entries_size(atlas, entries);
+    res.time_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+    if (dumpname)
+        dump_to_svg(atlas, entries, dumpname, name);
+    return res;
 }
 
 // -------------------------------------------------------------------
@@ -640,9 +834,10 @@ struct test_on_smol
 {
     typedef smol_atlas_item_t* Entry;
     
-    test_on_smol(int width, int height)
+    test_on_smol(int width, int height, int flags = 0, int repack_flags = 0)
+    : m_repack_flags(repack_flags)
     {
-        m_atlas = sma_atlas_create(width, height);
+        m_atlas = sma_atlas_create(width, height, flags);
     }
     ~test_on_smol()
     {
@@ -668,62 +863,399 @@ struct test_on_smol
     {
     }
 
+    // same strategy as grow_atlas_and_repack, except that items are repacked in place
+    int grow_and_repack(HASHTABLE_TYPE<int, Entry>& entries, int e_id, int e_width, int e_height, size_t& moved_pixels)
+    {
+        // items straight from the atlas, instead of from the entries map
+        m_items.resize(sma_atlas_get_items(m_atlas, nullptr, 0));
+        sma_atlas_get_items(m_atlas, m_items.data(), (int)m_items.size());
+        m_old_places.clear();
+        for (Entry e : m_items)
+            m_old_places.push_back({ e, sma_item_x(e), sma_item_y(e) });
+
+        // the item that did not fit is repacked together with the others: make
+        // room for it below them first, then add it to the repacked set
+        int new_width = width();
+        int new_height = height();
+        Entry res = nullptr;
+        if (sma_atlas_repack(m_atlas, m_items.data(), (int)m_items.size(), m_repack_flags, std::max(new_width, e_width), new_height + e_height))
+            res = sma_item_add(m_atlas, e_width, e_height);
+        if (res != nullptr)
+            m_items.push_back(res);
+
+        int iterations = 1;
+        while (true) {
+            if (sma_atlas_repack(m_atlas, m_items.data(), (int)m_items.size(), m_repack_flags, new_width, new_height)) {
+                if (res == nullptr)
+                    res = sma_item_add(m_atlas, e_width, e_height);
+                if (res != nullptr)
+                    break;
+            }
+
+            // Failed packing into current atlas size, increase it.
+            ++iterations;
+            if (new_width <= new_height)
+                new_width += ATLAS_GROW_BY;
+            else
+                new_height += ATLAS_GROW_BY;
+        }
+
+        entries.insert({e_id, res});
+        for (const smol_item_move_t& place : m_old_places) {
+            if (sma_item_x(place.item) != place.old_x || sma_item_y(place.item) != place.old_y)
+                moved_pixels += size_t(sma_item_width(place.item)) * sma_item_height(place.item);
+        }
+        return iterations;
+    }
+
     smol_atlas_t* m_atlas;
+    const int m_repack_flags;
+    std::vector<Entry> m_items;
+    std::vector<smol_item_move_t> m_old_places;
+};
+
+struct test_on_smol_slabs : test_on_smol
+{
+    test_on_smol_slabs(int width, int height) : test_on_smol(width, height, SMA_ATLAS_SLABS) {}
+};
+
+// items can be placed rotated
+struct test_on_smol_rotate : test_on_smol
+{
+    test_on_smol_rotate(int width, int height) : test_on_smol(width, height, SMA_ATLAS_ROTATE) {}
+};
+
+// short items can be stacked within taller shelves
+struct test_on_smol_subshelf : test_on_smol
+{
+    test_on_smol_subshelf(int width, int height) : test_on_smol(width, height, SMA_ATLAS_SUBSHELVES) {}
+};
+
+// skyline packing engine
+struct test_on_smol_skyline : test_on_smol
+{
+    test_on_smol_skyline(int width, int height) : test_on_smol(width, height, SMA_ATLAS_SKYLINE) {}
+};
+
+// repacks keep most items where they are
+struct test_on_smol_stable : test_on_smol
+{
+    test_on_smol_stable(int width, int height) : test_on_smol(width, height, 0, SMA_REPACK_STABLE) {}
 };
 
 // -------------------------------------------------------------------
 
 int run_smol_atlas_tests();
+int run_bench_compare(const char* base_filename, const char* new_filename, double min_time_change);
+
+// Benchmark runner: each library x dataset combination is a "job". Jobs are
+// independent, so they can run on a pool of worker threads (each pinned to its
+// own core), and optionally be repeated several times to get min/median timings.
+// Results are always printed in job order, so output is deterministic.
+
+struct BenchJob {
+    const TestData* data;
+    const char* name;
+    std::string dumpname;
+    std::function<TestResult(const TestData&, const char*, const char*)> func;
+    TestResult result;
+    std::vector<double> times;
+};
 
-static void test_libs_on_synthetic()
+struct BenchOptions {
+    int threads = 1;
+    int repeat = 1;
+    bool shelf_search_only = false;
+    std::string workload; // only run this synthetic workload, if set
+    std::string json_file; // write results into this JSON file, if set
+};
+
+static void pin_current_thread_to_core(int core)
 {
-    printf("Running synthetic tests...\n");
-    printf("Library        EndItems Adds   Rems   GCs  Repacks AtlasSize MPix Used%% TimeMS\n");
-    
-    test_atlas_synthetic<test_on_smol>("smol-atlas", "out_syn_smol.svg");
-    #if TEST_ON_ETAGERE
-    test_atlas_synthetic<test_on_etagere>("etagere", "out_syn_etagere.svg");
-    #endif
-    #if TEST_ON_MAPBOX
-    test_atlas_synthetic<test_on_mapbox>("shelf-pack-cpp", "out_syn_mapbox.svg");
-    #endif
-    #if TEST_ON_STB_RECTPACK
-    test_atlas_synthetic<test_on_stb_rectpack>("stb_rect_pack", "out_syn_rectpack.svg");
-    #endif
-    #if TEST_ON_AW_RECTALLOCATOR
-    test_atlas_synthetic<test_on_aw_rectallocator>("RectAllocator", "out_syn_awralloc.svg");
-    #endif
+#if defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << (core % (sizeof(DWORD_PTR) * 8)));
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % CPU_SETSIZE, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)core; // macOS has no way to pin threads to cores
+#endif
+}
+
+static void run_bench_job(BenchJob& job, int repeat)
+{
+    job.times.clear();
+    for (int i = 0; i < repeat; ++i) {
+        // only dump SVG on the first run, the results are the same anyway
+        TestResult res = job.func(*job.data, job.name, i == 0 ? job.dumpname.c_str() : nullptr);
+        if (i == 0)
+            job.result = res;
+        job.times.push_back(res.time_ms);
+    }
+    std::sort(job.times.begin(), job.times.end());
 }
 
-static void test_libs_on_data(const char* data_name)
+static void run_bench_jobs(std::vector<BenchJob>& jobs, const BenchOptions& opt)
 {
-    load_test_data((std::string("test/thumbs-") + data_name + ".txt").c_str());
-    test_atlas_on_data<test_on_smol>("smol-atlas", (std::string("out_data_") + data_name + "_smol.svg").c_str());
+    int thread_count = std::min(opt.threads, (int)jobs.size());
+    if (thread_count <= 1) {
+        for (BenchJob& job : jobs)
+            run_bench_job(job, opt.repeat);
+        return;
+    }
+
+    const int core_count = std::max(1, (int)std::thread::hardware_concurrency());
+    std::atomic<int> next_job(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            pin_current_thread_to_core(t % core_count);
+            while (true) {
+                int idx = next_job.fetch_add(1);
+                if (idx >= (int)jobs.size())
+                    break;
+                run_bench_job(jobs[idx], opt.repeat);
+            }
+        });
+    }
+    for (std::thread& t : threads)
+        t.join();
+}
+
+static void print_bench_header(const BenchOptions& opt)
+{
+    if (opt.repeat > 1)
+        printf("Library        EndItems Adds   Rems   GCs  Repacks MovKPx  Allocs AtlasSize MPix Used%% MinMS  MedMS\n");
+    else
+        printf("Library        EndItems Adds   Rems   GCs  Repacks MovKPx  Allocs AtlasSize MPix Used%% TimeMS\n");
+}
+
+static void print_bench_job(const BenchJob& job, const BenchOptions& opt)
+{
+    const TestResult& res = job.result;
+    // kilopixels moved per repack
+    const double moved_kpix = res.repack_calls ? res.moved_pixels / 1.0e3 / res.repack_calls : 0.0;
+    printf("%14s %8i %6i %6i %4i %7i %6.0f %7zu %ix%i %4.1f %5.1f %6.1f",
+           job.name,
+           res.end_items, res.insertions, res.removals, res.gcs, res.repacks, moved_kpix, res.allocs,
+           res.width, res.height, res.width * res.height / 1.0e6,
+           res.entry_total * 100.0 / (res.width * res.height),
+           job.times.front());
+    if (opt.repeat > 1)
+        printf(" %6.1f", job.times[job.times.size() / 2]);
+    printf("\n");
+}
+
+// Write results of all jobs into a JSON file, to be compared later
+// with `-compare` (see bench-compare.cpp for the format).
+static bool write_bench_json(const char* filename, const std::vector<BenchJob>& jobs, const BenchOptions& opt)
+{
+    FILE* f = fopen(filename, "wt");
+    if (!f) {
+        printf("ERROR: could not write results file '%s'\n", filename);
+        return false;
+    }
+    fprintf(f, "{\n  \"version\": 1,\n  \"repeat\": %i,\n  \"results\": [\n", opt.repeat);
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const BenchJob& job = jobs[i];
+        const TestResult& res = job.result;
+        const std::string data_name = job.data->workload ? std::string("syn-") + job.data->workload->name : job.data->name;
+        fprintf(f, "    {\"data\": \"%s\", \"library\": \"%s\", ", data_name.c_str(), job.name);
+        fprintf(f, "\"end_items\": %i, \"insertions\": %i, \"removals\": %i, \"gcs\": %i, \"repacks\": %i, \"repack_calls\": %i, ",
+                res.end_items, res.insertions, res.removals, res.gcs, res.repacks, res.repack_calls);
+        fprintf(f, "\"moved_pixels\": %zu, \"allocs\": %zu, \"width\": %i, \"height\": %i, \"used\": %.3f, \"times_ms\": [",
+                res.moved_pixels, res.allocs, res.width, res.height,
+                res.entry_total * 100.0 / (res.width * res.height));
+        for (size_t t = 0; t < job.times.size(); ++t)
+            fprintf(f, "%s%.4f", t ? ", " : "", job.times[t]);
+        fprintf(f, "]}%s\n", i + 1 < jobs.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    return true;
+}
+
+template<typename T>
+static void add_jobs_for_lib(std::vector<BenchJob>& jobs, const TestData& data, const char* name, const char* dumpsuffix)
+{
+    BenchJob job;
+    job.data = &data;
+    job.name = name;
+    if (data.workload) {
+        // keep the original file names for the default uniform workload
+        job.dumpname = data.workload == &k_synthetic_workloads[0]
+            ? std::string("out_syn_") + dumpsuffix + ".svg"
+            : std::string("out_syn_") + data.workload->name + "_" + dumpsuffix + ".svg";
+        job.func = test_atlas_synthetic<T>;
+    }
+    else {
+        job.dumpname = std::string("out_data_") + data.name + "_" + dumpsuffix + ".svg";
+        job.func = test_atlas_on_data<T>;
+    }
+    jobs.emplace_back(job);
+}
+
+static void add_jobs_for_data(std::vector<BenchJob>& jobs, const TestData& data)
+{
+    add_jobs_for_lib<test_on_smol>(jobs, data, "smol-atlas", "smol");
+    add_jobs_for_lib<test_on_smol_slabs>(jobs, data, "smol-slabs", "smol_slabs");
+    add_jobs_for_lib<test_on_smol_stable>(jobs, data, "smol-stable", "smol_stable");
+    add_jobs_for_lib<test_on_smol_rotate>(jobs, data, "smol-rotate", "smol_rotate");
+    add_jobs_for_lib<test_on_smol_subshelf>(jobs, data, "smol-subshelf", "smol_subshelf");
+    add_jobs_for_lib<test_on_smol_skyline>(jobs, data, "smol-skyline", "smol_skyline");
     #if TEST_ON_ETAGERE
-    test_atlas_on_data<test_on_etagere>("etagere", (std::string("out_data_") + data_name + "_etagere.svg").c_str());
+    add_jobs_for_lib<test_on_etagere>(jobs, data, "etagere", "etagere");
     #endif
     #if TEST_ON_MAPBOX
-    test_atlas_on_data<test_on_mapbox>("shelf-pack-cpp", (std::string("out_data_") + data_name + "_mapbox.svg").c_str());
+    add_jobs_for_lib<test_on_mapbox>(jobs, data, "shelf-pack-cpp", "mapbox");
     #endif
     #if TEST_ON_STB_RECTPACK
-    test_atlas_on_data<test_on_stb_rectpack>("stb_rect_pack", (std::string("out_data_") + data_name + "_rectpack.svg").c_str());
+    add_jobs_for_lib<test_on_stb_rectpack>(jobs, data, "stb_rect_pack", "rectpack");
     #endif
     #if TEST_ON_AW_RECTALLOCATOR
-    test_atlas_on_data<test_on_aw_rectallocator>("RectAllocator", (std::string("out_data_") + data_name + "_awralloc.svg").c_str());
+    add_jobs_for_lib<test_on_aw_rectallocator>(jobs, data, "RectAllocator", "awralloc");
     #endif
 }
 
-int main()
+// Microbenchmark of item add cost depending on shelf count: atlas is filled
+// with full shelves of varying heights, then random items are removed and
+// added back, which has to search through the shelves to find the free space.
+static void test_shelf_search_scaling()
 {
+    printf("Running shelf search scaling test...\n");
+    printf("Shelves  ns/op\n");
+    for (int shelf_count = 64; shelf_count <= 2048; shelf_count *= 2) {
+        constexpr int k_width = 64;
+        constexpr int k_op_count = 200000;
+        smol_atlas_t* atlas = sma_atlas_create(k_width, 65535);
+        std::vector<smol_atlas_item_t*> items(shelf_count);
+        for (int i = 0; i < shelf_count; ++i)
+            items[i] = sma_item_add(atlas, k_width, i % 32 + 1);
+
+        pcg_state = 1;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < k_op_count; ++i) {
+            int idx = pcg32() % shelf_count;
+            sma_item_remove(atlas, items[idx]);
+            items[idx] = sma_item_add(atlas, k_width, idx % 32 + 1);
+            assert(items[idx]);
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / k_op_count;
+        printf("%7i %6.1f\n", shelf_count, ns);
+        sma_atlas_destroy(atlas);
+    }
+}
+
+static void print_usage()
+{
+    printf("Usage: smol-atlas [-j threads] [-r repeat] [-w workload] [-json file] [-shelves]\n");
+    printf("       smol-atlas -compare base.json new.json [min_time_change_percent]\n");
+    printf("  -j N      run benchmark jobs on N threads (0: one per core), default 1\n");
+    printf("  -r K      run each benchmark job K times and report min/median time, default 1\n");
+    printf("  -w NAME   only run the given synthetic workload:");
+    for (const SyntheticWorkload& wl : k_synthetic_workloads)
+        printf(" %s", wl.name);
+    printf("\n");
+    printf("  -json F   also write benchmark results into JSON file F\n");
+    printf("  -shelves  only run the shelf search scaling microbenchmark\n");
+    printf("  -compare  compare two JSON result files, flag significant changes;\n");
+    printf("            exit code is 1 if there are any regressions. Timings are only\n");
+    printf("            tested with 4 or more runs per job (-r 4), and flagged if they\n");
+    printf("            changed by at least min_time_change_percent (default 5)\n");
+}
+
+static bool parse_options(int argc, char** argv, BenchOptions& opt)
+{
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-shelves") == 0) {
+            opt.shelf_search_only = true;
+            continue;
+        }
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            opt.threads = atoi(argv[++i]);
+            if (opt.threads <= 0)
+                opt.threads = std::max(1, (int)std::thread::hardware_concurrency());
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            opt.repeat = std::max(1, atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "-json") == 0 && i + 1 < argc) {
+            opt.json_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            opt.workload = argv[++i];
+            bool known = false;
+            for (const SyntheticWorkload& wl : k_synthetic_workloads)
+                known |= opt.workload == wl.name;
+            if (!known) {
+                print_usage();
+                return false;
+            }
+        }
+        else {
+            print_usage();
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if ((argc == 4 || argc == 5) && strcmp(argv[1], "-compare") == 0)
+        return run_bench_compare(argv[2], argv[3], argc == 5 ? atof(argv[4]) / 100.0 : 0.05);
+
+    BenchOptions opt;
+    if (!parse_options(argc, argv, opt))
+        return 1;
+
     run_smol_atlas_tests();
-    
-    test_libs_on_synthetic();
-        
-    test_libs_on_data("gold");
-    test_libs_on_data("wingit");
-    test_libs_on_data("sprite-fright");
 
-    clear_test_data();
+    if (opt.shelf_search_only) {
+        test_shelf_search_scaling();
+        return 0;
+    }
+
+    // synthetic workloads first, then the recorded data sets
+    static const char* k_data_names[] = { "gold", "wingit", "sprite-fright" };
+    std::vector<TestData> datas;
+    for (const SyntheticWorkload& wl : k_synthetic_workloads) {
+        if (!opt.workload.empty() && opt.workload != wl.name)
+            continue;
+        TestData data;
+        data.description = wl.description;
+        data.workload = &wl;
+        datas.emplace_back(data);
+    }
+    if (opt.workload.empty()) {
+        for (const char* data_name : k_data_names) {
+            datas.emplace_back();
+            load_test_data(data_name, datas.back());
+        }
+    }
+    const int data_count = (int)datas.size();
+
+    std::vector<BenchJob> jobs;
+    std::vector<size_t> data_job_start;
+    for (const TestData& data : datas) {
+        data_job_start.push_back(jobs.size());
+        add_jobs_for_data(jobs, data);
+    }
+    data_job_start.push_back(jobs.size());
+
+    run_bench_jobs(jobs, opt);
+
+    for (int i = 0; i < data_count; ++i) {
+        printf("%s\n", datas[i].description.c_str());
+        print_bench_header(opt);
+        for (size_t j = data_job_start[i]; j < data_job_start[i + 1]; ++j)
+            print_bench_job(jobs[j], opt);
+    }
+    if (!opt.json_file.empty() && !write_bench_json(opt.json_file.c_str(), jobs, opt))
+        return 1;
 
     return 0;
 }
@@ -5,6 +5,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 #if defined(_MSC_VER)
 #define BREAK_IN_DEBUGGER() __debugbreak()
@@ -265,6 +275,1032 @@ static void test_clear()
     sma_atlas_destroy(atlas);
 }
 
+static void test_pack_best_fit_many_shelves()
+{
+    // 20 full shelves, heights 1..20
+    smol_atlas_t* atlas = sma_atlas_create(10, 1000);
+    smol_atlas_item_t* items[20];
+    for (int i = 0; i < 20; ++i) {
+        items[i] = sma_item_add(atlas, 10, i + 1);
+        CHECK_ITEM(items[i], 0, i * (i + 1) / 2, 10, i + 1);
+    }
+
+    sma_item_remove(atlas, items[6]);
+    sma_item_remove(atlas, items[12]);
+    sma_item_remove(atlas, items[16]);
+
+    smol_atlas_item_t* e1 = sma_item_add(atlas, 10, 15);
+    CHECK_ITEM(e1, 0, 136, 10, 15);
+    smol_atlas_item_t* e2 = sma_item_add(atlas, 10, 12);
+    CHECK_ITEM(e2, 0, 78, 10, 12);
+    smol_atlas_item_t* e3 = sma_item_add(atlas, 10, 7);
+    CHECK_ITEM(e3, 0, 21, 10, 7);
+    // no free space in any shelf: new one
+    smol_atlas_item_t* e4 = sma_item_add(atlas, 10, 3);
+    CHECK_ITEM(e4, 0, 210, 10, 3);
+
+    sma_atlas_destroy(atlas);
+}
+
+static void test_slabs()
+{
+    smol_atlas_t* atlas = sma_atlas_create(64, 64, SMA_ATLAS_SLABS);
+
+    // first item of a size class goes into a regular shelf
+    smol_atlas_item_t* e1 = sma_item_add(atlas, 32, 16);
+    CHECK_ITEM(e1, 0, 0, 32, 16);
+    // once there are enough items of the class, it gets slab shelves
+    smol_atlas_item_t* e2 = sma_item_add(atlas, 32, 16);
+    CHECK_ITEM(e2, 0, 16, 32, 16);
+    // 30 pixels wide item is in same size class as 32
+    smol_atlas_item_t* e3 = sma_item_add(atlas, 30, 16);
+    CHECK_ITEM(e3, 32, 16, 30, 16);
+    smol_atlas_item_t* e4 = sma_item_add(atlas, 32, 16);
+    CHECK_ITEM(e4, 0, 32, 32, 16);
+
+    // removed slot gets reused
+    sma_item_remove(atlas, e3);
+    smol_atlas_item_t* e5 = sma_item_add(atlas, 32, 16);
+    CHECK_ITEM(e5, 32, 16, 32, 16);
+
+    // other sizes still go into regular shelves
+    smol_atlas_item_t* e6 = sma_item_add(atlas, 10, 16);
+    CHECK_ITEM(e6, 32, 0, 10, 16);
+
+    sma_atlas_destroy(atlas);
+}
+
+static void test_repack()
+{
+    smol_atlas_t* atlas = sma_atlas_create(40, 30);
+
+    smol_atlas_item_t* e1 = sma_item_add(atlas, 10, 10);
+    smol_atlas_item_t* e2 = sma_item_add(atlas, 20, 20);
+    smol_atlas_item_t* e3 = sma_item_add(atlas, 10, 10);
+    smol_atlas_item_t* e4 = sma_item_add(atlas, 15, 20);
+    CHECK_ITEM(e1, 0, 0, 10, 10);
+    CHECK_ITEM(e2, 0, 10, 20, 20);
+    CHECK_ITEM(e3, 10, 0, 10, 10);
+    CHECK_ITEM(e4, 20, 10, 15, 20);
+
+    // repack into a smaller atlas does not fit, atlas is left as it was
+    smol_atlas_item_t* items[] = { e1, e2, e3, e4 };
+    CHECK(!sma_atlas_repack(atlas, items, 4, 0, 40, 20));
+    CHECK_EQ(40, sma_atlas_width(atlas));
+    CHECK_EQ(30, sma_atlas_height(atlas));
+    CHECK_ITEM(e2, 0, 10, 20, 20);
+
+    // repack: taller items first, then wider items first
+    CHECK(sma_atlas_repack(atlas, items, 4, 0, 60, 20));
+    CHECK_EQ(60, sma_atlas_width(atlas));
+    CHECK_EQ(20, sma_atlas_height(atlas));
+    CHECK_ITEM(e2, 0, 0, 20, 20);
+    CHECK_ITEM(e4, 20, 0, 15, 20);
+    CHECK_ITEM(e1, 35, 0, 10, 10);
+    CHECK_ITEM(e3, 45, 0, 10, 10);
+
+    // removal and adding after a repack works
+    sma_item_remove(atlas, e4);
+    smol_atlas_item_t* e5 = sma_item_add(atlas, 15, 20);
+    CHECK_ITEM(e5, 20, 0, 15, 20);
+
+    // more orderings, atlas stays same size
+    items[3] = e5;
+    CHECK(sma_atlas_repack(atlas, items, 4, SMA_REPACK_TRY_ORDERINGS));
+    CHECK_EQ(60, sma_atlas_width(atlas));
+    CHECK_EQ(20, sma_atlas_height(atlas));
+
+    sma_atlas_destroy(atlas);
+}
+
+static void test_repack_stable()
+{
+    smol_atlas_t* atlas = sma_atlas_create(100, 100);
+
+    smol_atlas_item_t* a[4];
+    for (int i = 0; i < 4; ++i)
+        a[i] = sma_item_add(atlas, 20, 10);
+    smol_atlas_item_t* b1 = sma_item_add(atlas, 30, 20);
+    smol_atlas_item_t* b2 = sma_item_add(atlas, 30, 20);
+    smol_atlas_item_t* b3 = sma_item_add(atlas, 30, 20);
+    smol_atlas_item_t* c1 = sma_item_add(atlas, 30, 10);
+    smol_atlas_item_t* c2 = sma_item_add(atlas, 30, 10);
+    CHECK_ITEM(a[3], 60, 0, 20, 10);
+    CHECK_ITEM(b2, 30, 10, 30, 20);
+    CHECK_ITEM(c1, 0, 30, 30, 10);
+    CHECK_ITEM(c2, 30, 30, 30, 10);
+    sma_item_remove(atlas, b1);
+    sma_item_remove(atlas, b3);
+
+    // middle shelf is less than half full: its item moves into the row
+    // freed by that shelf, everything else stays in place
+    smol_atlas_item_t* items[] = { a[0], a[1], a[2], a[3], b2, c1, c2, nullptr };
+    CHECK(sma_atlas_repack(atlas, items, 7, SMA_REPACK_STABLE));
+    const smol_item_move_t* moves = nullptr;
+    CHECK_EQ(1, sma_atlas_repack_moves(atlas, &moves));
+    CHECK(moves[0].item == b2);
+    CHECK_EQ(30, moves[0].old_x);
+    CHECK_EQ(10, moves[0].old_y);
+    CHECK_ITEM(b2, 0, 10, 30, 20);
+    CHECK_ITEM(a[3], 60, 0, 20, 10);
+    CHECK_ITEM(c1, 0, 30, 30, 10);
+    CHECK_ITEM(c2, 30, 30, 30, 10);
+
+    // new shelves go above the existing ones
+    smol_atlas_item_t* d = sma_item_add(atlas, 100, 20);
+    CHECK_ITEM(d, 0, 40, 100, 20);
+
+    // growing the atlas: shelves get wider, only the sparse shelf item moves
+    items[7] = d;
+    CHECK(sma_atlas_repack(atlas, items, 8, SMA_REPACK_STABLE, 200, 100));
+    CHECK_EQ(1, sma_atlas_repack_moves(atlas, &moves));
+    CHECK(moves[0].item == b2);
+    CHECK_ITEM(b2, 100, 40, 30, 20);
+    CHECK_ITEM(d, 0, 40, 100, 20);
+    smol_atlas_item_t* e = sma_item_add(atlas, 100, 10);
+    CHECK_ITEM(e, 80, 0, 100, 10);
+
+    // shrinking: items that do not fit anymore are moved
+    sma_item_remove(atlas, e);
+    CHECK(sma_atlas_repack(atlas, items, 8, SMA_REPACK_STABLE, 100, 60));
+    CHECK_EQ(1, sma_atlas_repack_moves(atlas, nullptr));
+    CHECK_ITEM(b2, 0, 10, 30, 20);
+    CHECK(!sma_atlas_repack(atlas, items, 8, SMA_REPACK_STABLE, 100, 40));
+    CHECK_ITEM(d, 0, 40, 100, 20);
+    CHECK_EQ(1, sma_atlas_repack_moves(atlas, nullptr));
+
+    sma_atlas_destroy(atlas);
+}
+
+static void test_repack_async()
+{
+    smol_atlas_t* atlas = sma_atlas_create(40, 30);
+
+    smol_atlas_item_t* e1 = sma_item_add(atlas, 10, 10);
+    smol_atlas_item_t* e2 = sma_item_add(atlas, 20, 20);
+    smol_atlas_item_t* e3 = sma_item_add(atlas, 10, 10);
+    smol_atlas_item_t* e4 = sma_item_add(atlas, 15, 20);
+    smol_atlas_item_t* items[] = { e1, e2, e3, e4 };
+
+    CHECK(sma_atlas_repack_async_begin(atlas, items, 4, 0, 60, 20));
+    CHECK(!sma_atlas_repack_async_begin(atlas, items, 4, 0, 60, 20));
+    // atlas is still usable while repack is in progress
+    sma_item_remove(atlas, e3);
+    smol_atlas_item_t* e5 = sma_item_add(atlas, 5, 10);
+    CHECK_ITEM(e5, 10, 0, 5, 10);
+    CHECK_EQ(40, sma_atlas_width(atlas));
+
+    const smol_item_move_t* moves = nullptr;
+    int move_count = sma_atlas_repack_async_finish(atlas, &moves);
+    CHECK_EQ(4, move_count);
+    CHECK_EQ(60, sma_atlas_width(atlas));
+    CHECK_EQ(20, sma_atlas_height(atlas));
+    CHECK_ITEM(e2, 0, 0, 20, 20);
+    CHECK_ITEM(e4, 20, 0, 15, 20);
+    CHECK_ITEM(e1, 35, 0, 10, 10);
+    CHECK_ITEM(e5, 45, 0, 5, 10); // added during repack, placed into new layout
+    CHECK(moves[0].item == e2);
+    CHECK_EQ(0, moves[0].old_x);
+    CHECK_EQ(10, moves[0].old_y);
+    CHECK(moves[3].item == e5);
+    CHECK_EQ(10, moves[3].old_x);
+    CHECK_EQ(0, moves[3].old_y);
+
+    // no repack in progress
+    CHECK_EQ(-1, sma_atlas_repack_async_finish(atlas));
+
+    // new layout does not fit after additions: atlas stays as it was
+    smol_atlas_item_t* items2[] = { e1, e2, e4, e5 };
+    CHECK(sma_atlas_repack_async_begin(atlas, items2, 4, 0, 50, 20));
+    smol_atlas_item_t* e6 = sma_item_add(atlas, 10, 10);
+    CHECK_ITEM(e6, 50, 0, 10, 10);
+    CHECK_EQ(-1, sma_atlas_repack_async_finish(atlas));
+    CHECK_EQ(60, sma_atlas_width(atlas));
+    CHECK_ITEM(e6, 50, 0, 10, 10);
+
+    sma_atlas_destroy(atlas);
+}
+
+static void fill_item_pixels(smol_atlas_t* atlas, smol_atlas_item_t* item, unsigned char value)
+{
+    unsigned char pixels[20 * 20 * 4];
+    memset(pixels, value, sizeof(pixels));
+    sma_item_write_pixels(atlas, item, pixels, 20 * 4);
+}
+
+static bool check_item_pixels(smol_atlas_t* atlas, const smol_atlas_item_t* item, unsigned char value)
+{
+    int pitch = 0;
+    const unsigned char* pixels = (const unsigned char*)sma_atlas_pixels(atlas, &pitch);
+    for (int y = sma_item_y(item); y < sma_item_y(item) + sma_item_height(item); ++y) {
+        for (int x = sma_item_x(item) * 4; x < (sma_item_x(item) + sma_item_width(item)) * 4; ++x) {
+            if (pixels[y * pitch + x] != value)
+                return false;
+        }
+    }
+    return true;
+}
+
+static void test_pixels()
+{
+    smol_atlas_t* atlas = sma_atlas_create(40, 30);
+    CHECK(sma_atlas_pixels(atlas) == nullptr);
+    sma_atlas_attach_pixels(atlas, SMA_PIXELS_RGBA8, 64);
+    int pitch = 0;
+    const unsigned char* pixels = (const unsigned char*)sma_atlas_pixels(atlas, &pitch);
+    CHECK(pixels != nullptr);
+    CHECK_EQ(192, pitch);
+
+    smol_atlas_item_t* e1 = sma_item_add(atlas, 10, 10);
+    smol_atlas_item_t* e2 = sma_item_add(atlas, 20, 20);
+    smol_atlas_item_t* e3 = sma_item_add(atlas, 10, 10);
+    smol_atlas_item_t* e4 = sma_item_add(atlas, 15, 20);
+    fill_item_pixels(atlas, e1, 1);
+    fill_item_pixels(atlas, e2, 2);
+    fill_item_pixels(atlas, e3, 3);
+    fill_item_pixels(atlas, e4, 4);
+    CHECK_ITEM(e4, 20, 10, 15, 20);
+    CHECK(check_item_pixels(atlas, e4, 4));
+
+    // repack into a wider atlas: pixels move with the items, new area is zeros
+    smol_atlas_item_t* items[] = { e1, e2, e3, e4 };
+    CHECK(sma_atlas_repack(atlas, items, 4, 0, 60, 20));
+    CHECK_ITEM(e2, 0, 0, 20, 20);
+    CHECK_ITEM(e4, 20, 0, 15, 20);
+    CHECK_ITEM(e1, 35, 0, 10, 10);
+    CHECK_ITEM(e3, 45, 0, 10, 10);
+    pixels = (const unsigned char*)sma_atlas_pixels(atlas, &pitch);
+    CHECK_EQ(256, pitch);
+    CHECK(check_item_pixels(atlas, e1, 1));
+    CHECK(check_item_pixels(atlas, e2, 2));
+    CHECK(check_item_pixels(atlas, e3, 3));
+    CHECK(check_item_pixels(atlas, e4, 4));
+    CHECK_EQ(0, pixels[19 * pitch + 59 * 4]);
+
+    // clearing clears the pixels too
+    sma_atlas_clear(atlas, 8, 8);
+    pixels = (const unsigned char*)sma_atlas_pixels(atlas, &pitch);
+    CHECK_EQ(64, pitch);
+    CHECK_EQ(0, pixels[0]);
+
+    sma_atlas_destroy(atlas);
+}
+
+static void test_upload()
+{
+    smol_atlas_t* atlas = sma_atlas_create(100, 100);
+    smol_atlas_item_t* e1 = sma_item_add(atlas, 10, 10);
+    smol_atlas_item_t* e2 = sma_item_add(atlas, 10, 10);
+    smol_atlas_item_t* e3 = sma_item_add(atlas, 10, 10);
+    smol_atlas_item_t* e4 = sma_item_add(atlas, 10, 5);
+    smol_atlas_item_t* e5 = sma_item_add(atlas, 20, 20);
+    CHECK_ITEM(e4, 30, 0, 10, 5);
+    CHECK_ITEM(e5, 0, 10, 20, 20);
+
+    unsigned char pixels[20 * 20];
+    sma_upload_begin(atlas, SMA_PIXELS_R8);
+    memset(pixels, 5, sizeof(pixels)); sma_upload_push(atlas, e5, pixels);
+    memset(pixels, 3, sizeof(pixels)); sma_upload_push(atlas, e3, pixels);
+    memset(pixels, 1, sizeof(pixels)); sma_upload_push(atlas, e1, pixels, 20);
+    memset(pixels, 4, sizeof(pixels)); sma_upload_push(atlas, e4, pixels);
+    memset(pixels, 2, sizeof(pixels)); sma_upload_push(atlas, e2, pixels);
+
+    // items of first shelf are merged into one region
+    const void* buffer = nullptr;
+    size_t buffer_size = 0;
+    const smol_upload_region_t* regions = nullptr;
+    CHECK_EQ(2, sma_upload_end(atlas, &buffer, &buffer_size, &regions));
+    CHECK_EQ(800, int(buffer_size));
+    CHECK_EQ(0, int(regions[0].offset));
+    CHECK_EQ(40, regions[0].row_pitch);
+    CHECK_EQ(0, regions[0].x);
+    CHECK_EQ(0, regions[0].y);
+    CHECK_EQ(40, regions[0].width);
+    CHECK_EQ(10, regions[0].height);
+    CHECK_EQ(400, int(regions[1].offset));
+    CHECK_EQ(20, regions[1].row_pitch);
+    CHECK_EQ(0, regions[1].x);
+    CHECK_EQ(10, regions[1].y);
+    const unsigned char* data = (const unsigned char*)buffer;
+    CHECK_EQ(1, data[0]);
+    CHECK_EQ(2, data[9 * 40 + 10]);
+    CHECK_EQ(3, data[9 * 40 + 29]);
+    CHECK_EQ(4, data[4 * 40 + 30]);
+    CHECK_EQ(0, data[5 * 40 + 30]); // below shorter item
+    CHECK_EQ(5, data[400 + 19 * 20 + 19]);
+
+    // not adjacent items are separate regions; offsets and rows are aligned
+    sma_upload_begin(atlas, SMA_PIXELS_R8, 16);
+    sma_upload_push(atlas, e3, pixels);
+    sma_upload_push(atlas, e1, pixels);
+    CHECK_EQ(2, sma_upload_end(atlas, &buffer, &buffer_size, &regions));
+    CHECK_EQ(0, regions[0].x);
+    CHECK_EQ(16, regions[0].row_pitch);
+    CHECK_EQ(20, regions[1].x);
+    CHECK_EQ(160, int(regions[1].offset));
+    CHECK_EQ(320, int(buffer_size));
+
+    sma_atlas_destroy(atlas);
+}
+
+static void test_rotate()
+{
+    smol_atlas_t* atlas = sma_atlas_create(100, 100, SMA_ATLAS_ROTATE);
+    smol_atlas_item_t* e1 = sma_item_add(atlas, 30, 10);
+    CHECK_ITEM(e1, 0, 0, 30, 10);
+    CHECK(!sma_item_rotated(e1));
+
+    // tall item rotated fits the existing shelf exactly
+    smol_atlas_item_t* e2 = sma_item_add(atlas, 10, 30);
+    CHECK_ITEM(e2, 30, 0, 30, 10);
+    CHECK(sma_item_rotated(e2));
+
+    // not rotated fits better
+    smol_atlas_item_t* e3 = sma_item_add(atlas, 5, 8);
+    CHECK_ITEM(e3, 60, 0, 5, 8);
+    CHECK(!sma_item_rotated(e3));
+
+    // new shelf: lying down makes it less tall
+    smol_atlas_item_t* e4 = sma_item_add(atlas, 20, 40);
+    CHECK_ITEM(e4, 0, 10, 40, 20);
+    CHECK(sma_item_rotated(e4));
+
+    // pixels are written rotated
+    sma_atlas_attach_pixels(atlas, SMA_PIXELS_R8);
+    smol_atlas_item_t* e5 = sma_item_add(atlas, 10, 25);
+    CHECK_ITEM(e5, 65, 0, 25, 10);
+    unsigned char src[10 * 25];
+    for (int i = 0; i < 10 * 25; ++i)
+        src[i] = (unsigned char)i;
+    sma_item_write_pixels(atlas, e5, src);
+    int pitch = 0;
+    const unsigned char* pixels = (const unsigned char*)sma_atlas_pixels(atlas, &pitch);
+    CHECK_EQ(240, pixels[65]); // bottom left source pixel goes to top left
+    CHECK_EQ(0, pixels[65 + 24]);
+    CHECK_EQ(249, pixels[9 * pitch + 65]);
+    CHECK_EQ(215, pixels[5 * pitch + 65 + 3]);
+
+    // without the flag, items are never rotated
+    sma_atlas_destroy(atlas);
+    atlas = sma_atlas_create(100, 100);
+    sma_item_add(atlas, 30, 10);
+    e2 = sma_item_add(atlas, 10, 30);
+    CHECK_ITEM(e2, 0, 10, 10, 30);
+    CHECK(!sma_item_rotated(e2));
+    sma_atlas_destroy(atlas);
+}
+
+static void test_subshelves()
+{
+    smol_atlas_t* atlas = sma_atlas_create(100, 100, SMA_ATLAS_SUBSHELVES);
+    smol_atlas_item_t* e1 = sma_item_add(atlas, 20, 40);
+    CHECK_ITEM(e1, 0, 0, 20, 40);
+
+    // short items get stacked in a column within the tall shelf
+    smol_atlas_item_t* e2 = sma_item_add(atlas, 10, 10);
+    smol_atlas_item_t* e3 = sma_item_add(atlas, 10, 10);
+    smol_atlas_item_t* e4 = sma_item_add(atlas, 8, 15);
+    CHECK_ITEM(e2, 20, 0, 10, 10);
+    CHECK_ITEM(e3, 20, 10, 10, 10);
+    CHECK_ITEM(e4, 20, 20, 8, 15);
+
+    // more than half of shelf height: goes into the shelf directly
+    smol_atlas_item_t* e5 = sma_item_add(atlas, 10, 30);
+    CHECK_ITEM(e5, 30, 0, 10, 30);
+
+    // freed column space is reused; empty column goes back to the shelf
+    sma_item_remove(atlas, e3);
+    smol_atlas_item_t* e6 = sma_item_add(atlas, 10, 5);
+    CHECK_ITEM(e6, 20, 10, 10, 5);
+    sma_item_remove(atlas, e2);
+    sma_item_remove(atlas, e4);
+    sma_item_remove(atlas, e6);
+    smol_atlas_item_t* e7 = sma_item_add(atlas, 10, 40);
+    CHECK_ITEM(e7, 20, 0, 10, 40);
+
+    sma_atlas_destroy(atlas);
+}
+
+static void test_skyline()
+{
+    smol_atlas_t* atlas = sma_atlas_create(100, 100, SMA_ATLAS_SKYLINE);
+    smol_atlas_item_t* e1 = sma_item_add(atlas, 50, 40);
+    smol_atlas_item_t* e2 = sma_item_add(atlas, 30, 10);
+    smol_atlas_item_t* e3 = sma_item_add(atlas, 20, 20);
+    CHECK_ITEM(e1, 0, 0, 50, 40);
+    CHECK_ITEM(e2, 50, 0, 30, 10);
+    CHECK_ITEM(e3, 80, 0, 20, 20);
+
+    // lowest position that fits
+    smol_atlas_item_t* e4 = sma_item_add(atlas, 30, 30);
+    CHECK_ITEM(e4, 50, 10, 30, 30);
+    smol_atlas_item_t* e5 = sma_item_add(atlas, 50, 10);
+    CHECK_ITEM(e5, 0, 40, 50, 10);
+
+    // removing an item on top gives its space back
+    sma_item_remove(atlas, e5);
+    e5 = sma_item_add(atlas, 20, 20);
+    CHECK_ITEM(e5, 80, 20, 20, 20);
+
+    // removing an item below others gives its space back once they are removed too
+    sma_item_remove(atlas, e2);
+    smol_atlas_item_t* e6 = sma_item_add(atlas, 30, 10);
+    CHECK_ITEM(e6, 0, 40, 30, 10);
+    sma_item_remove(atlas, e6);
+    sma_item_remove(atlas, e4);
+    e6 = sma_item_add(atlas, 30, 40);
+    CHECK_ITEM(e6, 50, 0, 30, 40);
+
+    // too large
+    CHECK(sma_item_add(atlas, 101, 10) == nullptr);
+    CHECK(sma_item_add(atlas, 50, 61) == nullptr);
+
+    // repack
+    smol_atlas_item_t* items[] = { e1, e3, e5, e6 };
+    CHECK(sma_atlas_repack(atlas, items, 4, 0, 200, 100));
+    CHECK_ITEM(e1, 0, 0, 50, 40);
+    CHECK_ITEM(e6, 50, 0, 30, 40);
+    CHECK_ITEM(e3, 80, 0, 20, 20);
+    CHECK_ITEM(e5, 100, 0, 20, 20);
+    sma_item_remove(atlas, e1);
+    e1 = sma_item_add(atlas, 50, 50);
+    CHECK_ITEM(e1, 0, 0, 50, 50);
+
+    sma_atlas_destroy(atlas);
+}
+
+static void test_trim()
+{
+    smol_atlas_t* atlas = sma_atlas_create(1024, 1024);
+    const int count = 5000;
+    smol_atlas_item_t** items = new smol_atlas_item_t*[count];
+    for (int i = 0; i < count; ++i)
+        items[i] = sma_item_add(atlas, 1, 1);
+
+    // item pool grew geometrically: 1024, 1024, 2048, 4096
+    smol_atlas_memory_t mem;
+    sma_atlas_memory(atlas, &mem);
+    CHECK_EQ(count, (int)mem.items.used);
+    CHECK_EQ(8192, (int)mem.items.capacity);
+    CHECK_EQ(count, (int)mem.items.high_water);
+
+    // remove all but the first few items; chunks other than the first one
+    // have no used items and can be released
+    for (int i = 10; i < count; ++i)
+        sma_item_remove(atlas, items[i]);
+    sma_atlas_memory(atlas, &mem);
+    CHECK_EQ(10, (int)mem.items.used);
+    CHECK_EQ(count, (int)mem.items.high_water);
+    CHECK(sma_atlas_trim(atlas) > 0);
+    sma_atlas_memory(atlas, &mem);
+    CHECK_EQ(10, (int)mem.items.used);
+    CHECK_EQ(1024, (int)mem.items.capacity);
+    CHECK_EQ(10, (int)mem.items.high_water);
+    CHECK_ITEM(items[9], 9, 0, 1, 1);
+    CHECK_EQ(0, (int)sma_atlas_trim(atlas));
+
+    // can still add items after trimming
+    for (int i = 10; i < count; ++i)
+        items[i] = sma_item_add(atlas, 1, 1);
+    CHECK_ITEM(items[count - 1], (count - 1) % 1024, (count - 1) / 1024, 1, 1);
+    sma_atlas_memory(atlas, &mem);
+    CHECK_EQ(count, (int)mem.items.used);
+    const int capacity = (int)mem.items.capacity;
+
+    // clear keeps the memory, and it gets reused
+    sma_atlas_clear(atlas);
+    sma_atlas_memory(atlas, &mem);
+    CHECK_EQ(0, (int)mem.items.used);
+    CHECK_EQ(capacity, (int)mem.items.capacity);
+    for (int i = 0; i < count; ++i)
+        items[i] = sma_item_add(atlas, 1, 1);
+    CHECK_ITEM(items[count - 1], (count - 1) % 1024, (count - 1) / 1024, 1, 1);
+    sma_atlas_memory(atlas, &mem);
+    CHECK_EQ(count, (int)mem.items.used);
+    CHECK_EQ(capacity, (int)mem.items.capacity);
+
+    delete[] items;
+    sma_atlas_destroy(atlas);
+}
+
+static void test_reserve_prewarm()
+{
+    smol_atlas_t* atlas = sma_atlas_create(100, 100);
+    sma_atlas_reserve(atlas, 3000, 2000, 16);
+    smol_atlas_memory_t mem;
+    sma_atlas_memory(atlas, &mem);
+    CHECK_EQ(3000, (int)mem.items.capacity);
+    CHECK_EQ(2000, (int)mem.spans.capacity);
+    for (int i = 0; i < 3000; ++i)
+        CHECK(sma_item_add(atlas, 1, 1) != nullptr);
+    sma_atlas_memory(atlas, &mem);
+    CHECK_EQ(3000, (int)mem.items.capacity);
+    sma_atlas_destroy(atlas);
+
+    // shelves are laid out tallest first
+    atlas = sma_atlas_create(100, 100);
+    const int heights[] = { 10, 30, 20 };
+    const int counts[] = { 1, 2, 1 };
+    CHECK_EQ(4, sma_atlas_prewarm_shelves(atlas, heights, counts, 3));
+    smol_atlas_item_t* e1 = sma_item_add(atlas, 50, 20);
+    smol_atlas_item_t* e2 = sma_item_add(atlas, 50, 10);
+    smol_atlas_item_t* e3 = sma_item_add(atlas, 60, 30);
+    smol_atlas_item_t* e4 = sma_item_add(atlas, 60, 28);
+    CHECK_ITEM(e1, 0, 60, 50, 20);
+    CHECK_ITEM(e2, 0, 80, 50, 10);
+    CHECK_ITEM(e3, 0, 0, 60, 30);
+    CHECK_ITEM(e4, 0, 30, 60, 28);
+
+    // no more space for shelves
+    const int tall = 20, one = 1;
+    CHECK_EQ(0, sma_atlas_prewarm_shelves(atlas, &tall, &one, 1));
+    sma_atlas_destroy(atlas);
+}
+
+static void count_item_user_data(smol_atlas_item_t* item, void* user_ptr)
+{
+    *(uint64_t*)user_ptr += sma_item_user_data(item);
+}
+
+static void test_item_iteration()
+{
+    smol_atlas_t* atlas = sma_atlas_create(100, 100);
+    CHECK_EQ(0, sma_atlas_get_items(atlas, nullptr, 0));
+    smol_atlas_item_t* items[6];
+    for (int i = 0; i < 6; ++i) {
+        items[i] = sma_item_add(atlas, 10, 10 + i);
+        CHECK(sma_item_user_data(items[i]) == 0);
+        sma_item_set_user_data(items[i], uint64_t(1) << (i + 32));
+    }
+    sma_item_remove(atlas, items[1]);
+    sma_item_remove(atlas, items[4]);
+
+    // items are in memory order, which is the order of addition here
+    smol_atlas_item_t* got[6] = {};
+    CHECK_EQ(4, sma_atlas_get_items(atlas, got, 6));
+    CHECK(got[0] == items[0] && got[1] == items[2] && got[2] == items[3] && got[3] == items[5]);
+    CHECK_EQ(4, sma_atlas_get_items(atlas, got, 2));
+    uint64_t sum = 0;
+    sma_atlas_for_each_item(atlas, count_item_user_data, &sum);
+    CHECK(sum == (uint64_t(1) << 32) + (uint64_t(1) << 34) + (uint64_t(1) << 35) + (uint64_t(1) << 37));
+
+    // removed item memory gets reused, user data is reset; repack keeps user data
+    smol_atlas_item_t* e = sma_item_add(atlas, 5, 5);
+    CHECK(sma_item_user_data(e) == 0);
+    CHECK_EQ(5, sma_atlas_get_items(atlas, got, 6));
+    CHECK(sma_atlas_repack(atlas, got, 5));
+    sum = 0;
+    sma_atlas_for_each_item(atlas, count_item_user_data, &sum);
+    CHECK(sum == (uint64_t(1) << 32) + (uint64_t(1) << 34) + (uint64_t(1) << 35) + (uint64_t(1) << 37));
+
+    sma_atlas_clear(atlas);
+    CHECK_EQ(0, sma_atlas_get_items(atlas, got, 6));
+    sum = 0;
+    sma_atlas_for_each_item(atlas, count_item_user_data, &sum);
+    CHECK(sum == 0);
+    sma_atlas_destroy(atlas);
+}
+
+static void test_pinned()
+{
+    smol_atlas_t* atlas = sma_atlas_create(100, 100);
+    smol_atlas_item_t* a = sma_item_add(atlas, 10, 10);
+    smol_atlas_item_t* p = sma_item_add_pinned(atlas, 10, 10);
+    smol_atlas_item_t* b = sma_item_add(atlas, 10, 10);
+    smol_atlas_item_t* p2 = sma_item_add_pinned(atlas, 20, 8);
+    CHECK(!sma_item_pinned(a));
+    CHECK(sma_item_pinned(p) && sma_item_pinned(p2));
+    // pinned items get their own shelf, that regular items do not use
+    CHECK_ITEM(a, 0, 0, 10, 10);
+    CHECK_ITEM(p, 0, 10, 10, 10);
+    CHECK_ITEM(b, 10, 0, 10, 10);
+    CHECK_ITEM(p2, 10, 10, 20, 8);
+
+    // full repack keeps pinned items in place
+    sma_item_remove(atlas, a);
+    smol_atlas_item_t* items[3] = { b, p, p2 };
+    CHECK(sma_atlas_repack(atlas, items, 3));
+    CHECK_ITEM(p, 0, 10, 10, 10);
+    CHECK_ITEM(p2, 10, 10, 20, 8);
+    CHECK(sma_item_y(b) != 10);
+
+    // and so does a stable repack into a different size, and an unpinned item pinned later
+    CHECK(sma_item_set_pinned(atlas, b, true));
+    const int bx = sma_item_x(b), by = sma_item_y(b);
+    CHECK(sma_atlas_repack(atlas, items, 3, SMA_REPACK_STABLE, 60, 40));
+    CHECK_ITEM(b, bx, by, 10, 10);
+    CHECK_ITEM(p, 0, 10, 10, 10);
+    CHECK_ITEM(p2, 10, 10, 20, 8);
+
+    // repack fails if pinned items do not fit; unpinned items can move again
+    CHECK(!sma_atlas_repack(atlas, items, 3, 0, 25, 40));
+    CHECK(sma_item_set_pinned(atlas, p2, false));
+    CHECK(!sma_item_pinned(p2));
+    CHECK(sma_atlas_repack(atlas, items, 3, 0, 60, 40));
+    CHECK_ITEM(p, 0, 10, 10, 10);
+    sma_atlas_destroy(atlas);
+
+    // slabs: regular items never go into the pinned shelf, also after repacks
+    atlas = sma_atlas_create(100, 100, SMA_ATLAS_SLABS);
+    p = sma_item_add_pinned(atlas, 10, 10);
+    std::vector<smol_atlas_item_t*> all = { p };
+    for (int i = 0; i < 20; ++i)
+        all.push_back(sma_item_add(atlas, 10, 10));
+    CHECK(sma_atlas_repack(atlas, all.data(), int(all.size())));
+    CHECK(sma_atlas_repack(atlas, all.data(), int(all.size()), SMA_REPACK_STABLE));
+    for (int i = 0; i < 20; ++i)
+        all.push_back(sma_item_add(atlas, 10, 10));
+    CHECK_ITEM(p, 0, 0, 10, 10);
+    for (size_t i = 1; i < all.size(); ++i)
+        CHECK(all[i] != nullptr && sma_item_y(all[i]) >= 10);
+    for (smol_atlas_item_t* item : all)
+        sma_item_remove(atlas, item);
+    CHECK_EQ(0, sma_atlas_get_items(atlas, nullptr, 0));
+    sma_atlas_destroy(atlas);
+
+    // not supported with skyline
+    atlas = sma_atlas_create(100, 100, SMA_ATLAS_SKYLINE);
+    CHECK(sma_item_add_pinned(atlas, 10, 10) == nullptr);
+    a = sma_item_add(atlas, 10, 10);
+    CHECK(!sma_item_set_pinned(atlas, a, true));
+    sma_atlas_destroy(atlas);
+}
+
+static void test_composite()
+{
+    const int classes[] = { 16, 64 };
+    smol_composite_t* comp = sma_composite_create(100, 100, classes, 2);
+    CHECK_EQ(2, sma_composite_region_count(comp));
+
+    // glyphs and thumbnails go into their own regions; regions grow from the free bottom area
+    smol_atlas_item_t* g1 = sma_composite_item_add(comp, 10, 12);
+    smol_atlas_item_t* t1 = sma_composite_item_add(comp, 60, 40);
+    smol_atlas_item_t* g2 = sma_composite_item_add(comp, 10, 12);
+    int y1 = -1;
+    smol_atlas_t* glyphs = sma_composite_region(comp, 0, nullptr);
+    smol_atlas_t* thumbs = sma_composite_region(comp, 1, &y1);
+    CHECK_EQ(2, sma_atlas_get_items(glyphs, nullptr, 0));
+    CHECK_EQ(1, sma_atlas_get_items(thumbs, nullptr, 0));
+    CHECK_EQ(12, sma_atlas_height(glyphs));
+    CHECK_EQ(12, y1);
+    CHECK_EQ(0, sma_composite_item_y(comp, g1));
+    CHECK_EQ(0, sma_composite_item_y(comp, g2));
+    CHECK_EQ(10, sma_item_x(g2));
+    CHECK_EQ(12, sma_composite_item_y(comp, t1));
+    CHECK_EQ(0, sma_item_y(t1));
+    CHECK_EQ(0, sma_composite_region_moves(comp, nullptr));
+
+    // a new glyph shelf moves the thumbnail region down
+    smol_atlas_item_t* g3 = sma_composite_item_add(comp, 10, 8);
+    CHECK_EQ(8, sma_item_height(g3));
+    smol_atlas_item_t* g4 = sma_composite_item_add(comp, 95, 16);
+    CHECK_EQ(12, sma_composite_item_y(comp, g4));
+    sma_composite_region(comp, 1, &y1);
+    CHECK_EQ(31, y1);
+    CHECK_EQ(31, sma_composite_item_y(comp, t1));
+    const smol_region_move_t* moves = nullptr;
+    CHECK_EQ(1, sma_composite_region_moves(comp, &moves));
+    CHECK(moves[0].index == 1 && moves[0].old_y == 12 && moves[0].new_y == 31);
+
+    // free area runs out; thumbnails take the unused part of the glyph region
+    smol_atlas_item_t* t2 = sma_composite_item_add(comp, 60, 30);
+    CHECK(t2 != nullptr);
+    CHECK_EQ(30, sma_atlas_height(glyphs));
+    CHECK_EQ(30, sma_composite_item_y(comp, t1));
+    CHECK_EQ(70, sma_composite_item_y(comp, t2));
+    CHECK_EQ(1, sma_composite_region_moves(comp, &moves));
+    CHECK(moves[0].index == 1 && moves[0].old_y == 31 && moves[0].new_y == 30);
+    CHECK(sma_composite_item_add(comp, 60, 30) == nullptr);
+    CHECK_EQ(0, sma_composite_region_moves(comp, &moves));
+    CHECK(moves == nullptr);
+    sma_composite_item_remove(comp, t2);
+    CHECK_EQ(1, sma_atlas_get_items(thumbs, nullptr, 0));
+
+    sma_composite_clear(comp);
+    CHECK_EQ(0, sma_atlas_height(glyphs));
+    CHECK_EQ(0, sma_atlas_get_items(glyphs, nullptr, 0));
+    sma_composite_destroy(comp);
+}
+
+static void test_item_rect_concurrent_reads()
+{
+    smol_atlas_t* atlas = sma_atlas_create(100, 100);
+    smol_atlas_item_t* items[4];
+    for (int i = 0; i < 4; ++i)
+        items[i] = sma_item_add(atlas, 20, 10);
+    smol_item_rect_t r = sma_item_rect(items[2]);
+    CHECK_EQ(40, r.x);
+    CHECK_EQ(0, r.y);
+    CHECK_EQ(20, r.width);
+    CHECK_EQ(10, r.height);
+
+    // repack updates rectangles, and the epoch twice
+    const uint32_t epoch = sma_atlas_epoch(atlas);
+    CHECK(sma_atlas_repack(atlas, items, 4, 0, 40, 100));
+    CHECK(sma_atlas_epoch(atlas) == epoch + 2);
+    for (int i = 0; i < 4; ++i) {
+        r = sma_item_rect(items[i]);
+        CHECK_ITEM(items[i], r.x, r.y, r.width, r.height);
+    }
+
+#if SMOL_ATLAS_CONCURRENT_READS
+    // reads from another thread while repacks move items around: rectangles
+    // of a stable epoch never overlap
+    std::atomic<bool> done{ false };
+    std::atomic<int> bad_reads{ 0 };
+    std::thread reader([&]() {
+        while (!done.load()) {
+            const uint32_t e1 = sma_atlas_epoch(atlas);
+            smol_item_rect_t rects[4];
+            for (int i = 0; i < 4; ++i)
+                rects[i] = sma_item_rect(items[i]);
+            if ((e1 & 1) || sma_atlas_epoch(atlas) != e1)
+                continue;
+            for (int i = 0; i < 4; ++i) {
+                if (rects[i].width != 20 || rects[i].height != 10)
+                    ++bad_reads;
+                for (int j = 0; j < i; ++j) {
+                    if (rects[i].x < rects[j].x + rects[j].width && rects[j].x < rects[i].x + rects[i].width &&
+                        rects[i].y < rects[j].y + rects[j].height && rects[j].y < rects[i].y + rects[i].height)
+                        ++bad_reads;
+                }
+            }
+        }
+    });
+    for (int i = 0; i < 2000; ++i)
+        CHECK(sma_atlas_repack(atlas, items, 4, 0, (i & 1) ? 40 : 100, 100));
+    done = true;
+    reader.join();
+    CHECK_EQ(0, bad_reads.load());
+
+    // removed items read as empty
+    sma_item_remove(atlas, items[0]);
+    r = sma_item_rect(items[0]);
+    CHECK(r.x == 0 && r.y == 0 && r.width == 0 && r.height == 0);
+#endif
+    sma_atlas_destroy(atlas);
+
+#if !SMOL_ATLAS_16BIT_COORDS
+    // coordinates larger than 16 bits are kept
+    atlas = sma_atlas_create(140000, 10);
+    smol_atlas_item_t* wide[2] = { sma_item_add(atlas, 70000, 10), sma_item_add(atlas, 69000, 10) };
+    r = sma_item_rect(wide[1]);
+    CHECK(r.x == 70000 && r.y == 0 && r.width == 69000 && r.height == 10);
+    CHECK(sma_atlas_repack(atlas, wide, 2));
+    for (int i = 0; i < 2; ++i) {
+        r = sma_item_rect(wide[i]);
+        CHECK_ITEM(wide[i], r.x, r.y, r.width, r.height);
+    }
+    sma_atlas_destroy(atlas);
+#endif
+}
+
+static void test_shared_atlas()
+{
+    const size_t size = sma_shared_atlas_size(100, 8);
+    std::vector<uint64_t> memory(size / 8 + 1);
+    CHECK(sma_shared_atlas_init(memory.data(), size - 1, 100, 100, 8) == nullptr);
+    CHECK(sma_shared_atlas_attach(memory.data()) == nullptr);
+    smol_shared_atlas_t* atlas = sma_shared_atlas_init(memory.data(), size, 100, 100, 8);
+    CHECK(atlas != nullptr);
+
+    // same packing as regular atlases
+    const int a = sma_shared_item_add(atlas, 30, 20);
+    const int b = sma_shared_item_add(atlas, 30, 10);
+    const int c = sma_shared_item_add(atlas, 40, 20);
+    smol_item_rect_t r;
+    CHECK(sma_shared_item_rect(atlas, b, &r));
+    CHECK(r.x == 30 && r.y == 0 && r.width == 30 && r.height == 10);
+    sma_shared_item_remove(atlas, b);
+    CHECK(!sma_shared_item_rect(atlas, b, &r));
+    CHECK_EQ(2, sma_shared_atlas_item_count(atlas));
+    const int d = sma_shared_item_add(atlas, 60, 15);
+    CHECK(sma_shared_item_rect(atlas, d, &r));
+    CHECK(r.x == 0 && r.y == 20 && r.width == 60 && r.height == 15);
+    sma_shared_item_remove(atlas, c);
+    const int e = sma_shared_item_add(atlas, 70, 20); // free spans got merged
+    CHECK(sma_shared_item_rect(atlas, e, &r));
+    CHECK(r.x == 30 && r.y == 0);
+    CHECK_EQ(-1, sma_shared_item_add(atlas, 10, 70));
+    CHECK_EQ(-1, sma_shared_item_add(atlas, 101, 10));
+
+    // relocatable: a copy of the memory block at another address works the same
+    std::vector<uint64_t> copy = memory;
+    smol_shared_atlas_t* moved = sma_shared_atlas_attach(copy.data());
+    CHECK(moved != nullptr);
+    CHECK(sma_shared_item_rect(moved, a, &r));
+    CHECK(r.x == 0 && r.y == 0 && r.width == 30 && r.height == 20);
+    CHECK_EQ(3, sma_shared_atlas_item_count(moved));
+    sma_shared_atlas_clear(moved);
+    CHECK_EQ(0, sma_shared_atlas_item_count(moved));
+    CHECK_EQ(3, sma_shared_atlas_item_count(atlas));
+
+#if defined(__linux__)
+    // two processes adding and removing items in shared memory at the same time
+    const int item_count = 2000;
+    const size_t shared_size = sma_shared_atlas_size(1024, item_count * 2);
+    void* shared = mmap(nullptr, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    CHECK(shared != MAP_FAILED);
+    atlas = sma_shared_atlas_init(shared, shared_size, 1024, 1024, item_count * 2);
+    const pid_t pid = fork();
+    CHECK(pid >= 0);
+    smol_shared_atlas_t* mine = sma_shared_atlas_attach(shared);
+    std::vector<int> handles;
+    for (int i = 0; i < item_count; ++i) {
+        handles.push_back(sma_shared_item_add(mine, 5 + i % 13, 8 + i % 5));
+        if (handles.back() < 0)
+            _exit(1);
+        if (i % 3 == 2) {
+            sma_shared_item_remove(mine, handles[i / 2]);
+            handles[i / 2] = -1;
+        }
+    }
+    if (pid == 0)
+        _exit(0);
+    int status = 0;
+    CHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // both processes' items are there, and none overlap
+    const int live = sma_shared_atlas_item_count(atlas);
+    CHECK_EQ(2 * (item_count - item_count / 3), live);
+    std::vector<uint8_t> used(1024 * 1024);
+    int found = 0;
+    for (int i = 0; i < item_count * 2; ++i) {
+        if (!sma_shared_item_rect(atlas, i, &r))
+            continue;
+        ++found;
+        for (int y = r.y; y < r.y + r.height; ++y) {
+            for (int x = r.x; x < r.x + r.width; ++x) {
+                CHECK(used[y * 1024 + x] == 0);
+                used[y * 1024 + x] = 1;
+            }
+        }
+    }
+    CHECK_EQ(live, found);
+    munmap(shared, shared_size);
+#endif
+}
+
+static void test_write_uvs()
+{
+    smol_atlas_t* atlas = sma_atlas_create(256, 128);
+    smol_atlas_item_t* items[3];
+    items[0] = sma_item_add(atlas, 64, 32);
+    items[1] = sma_item_add(atlas, 128, 32);
+    items[2] = sma_item_add(atlas, 3, 96);
+
+    // float32, with a stride larger than the rectangle
+    float uvs[3][5] = {};
+    sma_atlas_write_uvs(atlas, items, 3, uvs, SMA_UV_FLOAT32, 5 * sizeof(float));
+    CHECK(uvs[0][0] == 0.0f && uvs[0][1] == 0.0f && uvs[0][2] == 0.25f && uvs[0][3] == 0.25f);
+    CHECK(uvs[1][0] == 0.25f && uvs[1][1] == 0.0f && uvs[1][2] == 0.75f && uvs[1][3] == 0.25f);
+    CHECK(uvs[2][0] == 0.0f && uvs[2][1] == 0.25f && uvs[2][2] == 3.0f / 256.0f && uvs[2][3] == 1.0f);
+    CHECK(uvs[0][4] == 0.0f && uvs[1][4] == 0.0f);
+
+    // unorm16 and half, tightly packed
+    uint16_t packed[3][4] = {};
+    sma_atlas_write_uvs(atlas, items, 3, packed, SMA_UV_UNORM16);
+    CHECK(packed[1][0] == 16384 && packed[1][1] == 0 && packed[1][2] == 49151 && packed[1][3] == 16384);
+    CHECK(packed[2][2] == 768 && packed[2][3] == 65535);
+    sma_atlas_write_uvs(atlas, items, 3, packed, SMA_UV_HALF);
+    CHECK(packed[1][0] == 0x3400 && packed[1][1] == 0 && packed[1][2] == 0x3A00 && packed[1][3] == 0x3400);
+    CHECK(packed[2][2] == 0x2200 && packed[2][3] == 0x3C00);
+    sma_atlas_destroy(atlas);
+}
+
+static void test_item_resize()
+{
+    smol_atlas_t* atlas = sma_atlas_create(100, 100);
+    smol_atlas_item_t* a = sma_item_add(atlas, 30, 20);
+    smol_atlas_item_t* b = sma_item_add(atlas, 30, 20);
+    bool moved = true;
+
+    // shrinking in place gives the tail back to the shelf
+    CHECK(sma_item_resize(atlas, a, 20, 15, &moved));
+    CHECK(!moved);
+    CHECK_ITEM(a, 0, 0, 20, 15);
+    smol_atlas_item_t* c = sma_item_add(atlas, 10, 20);
+    CHECK_ITEM(c, 20, 0, 10, 20);
+
+    // growing in place into the free span after the item; up to shelf height
+    CHECK(sma_item_resize(atlas, b, 70, 20, &moved));
+    CHECK(!moved);
+    CHECK_ITEM(b, 30, 0, 70, 20);
+    CHECK(sma_item_rect(b).width == 70);
+
+    // no room next to it, or taller than the shelf: item moves, pointer stays the same
+    sma_item_set_user_data(a, 7);
+    CHECK(sma_item_resize(atlas, a, 25, 20, &moved));
+    CHECK(moved);
+    CHECK_ITEM(a, 0, 20, 25, 20);
+    CHECK(sma_item_user_data(a) == 7);
+    CHECK(sma_item_resize(atlas, c, 10, 30, &moved));
+    CHECK(moved);
+    CHECK_ITEM(c, 0, 40, 10, 30);
+    // old spaces are free again
+    smol_atlas_item_t* d = sma_item_add(atlas, 30, 20);
+    CHECK_ITEM(d, 0, 0, 30, 20);
+    CHECK_EQ(4, sma_atlas_get_items(atlas, nullptr, 0));
+
+    // no room at all: item is left unchanged
+    CHECK(!sma_item_resize(atlas, c, 10, 90, &moved));
+    CHECK_ITEM(c, 0, 40, 10, 30);
+    sma_atlas_destroy(atlas);
+
+    // slabs: in place within the width size class; skyline: always moves
+    atlas = sma_atlas_create(64, 100, SMA_ATLAS_SLABS);
+    sma_item_add(atlas, 30, 20);
+    a = sma_item_add(atlas, 30, 20);
+    CHECK_ITEM(a, 0, 20, 30, 20); // on a slab shelf
+    CHECK(sma_item_resize(atlas, a, 29, 18, &moved));
+    CHECK(!moved);
+    CHECK_ITEM(a, 0, 20, 29, 18);
+    CHECK(sma_item_resize(atlas, a, 50, 18, &moved));
+    CHECK(moved);
+    CHECK_EQ(50, sma_item_width(a));
+    sma_atlas_destroy(atlas);
+    // in place on a regular shelf into another size class: a single item of the
+    // old class is not enough to start a slab shelf for it
+    atlas = sma_atlas_create(64, 100, SMA_ATLAS_SLABS);
+    a = sma_item_add(atlas, 30, 20);
+    CHECK(sma_item_resize(atlas, a, 10, 20, &moved));
+    CHECK(!moved);
+    b = sma_item_add(atlas, 30, 20);
+    CHECK_ITEM(b, 10, 0, 30, 20);
+    sma_atlas_destroy(atlas);
+    atlas = sma_atlas_create(100, 100, SMA_ATLAS_SKYLINE);
+    a = sma_item_add(atlas, 30, 20);
+    CHECK(sma_item_resize(atlas, a, 20, 20, &moved));
+    CHECK(moved);
+    CHECK_ITEM(a, 30, 0, 20, 20);
+    sma_atlas_destroy(atlas);
+}
+
+static void test_find_min_size()
+{
+    smol_item_size_t sizes[] = { {16, 16}, {16, 16}, {16, 16} };
+    smol_atlas_item_t* items[3] = {};
+
+    // smallest area is all of them in one row
+    smol_atlas_t* atlas = sma_atlas_find_min_size(sizes, 3, nullptr, items);
+    CHECK(atlas != nullptr);
+    CHECK_EQ(48, sma_atlas_width(atlas));
+    CHECK_EQ(16, sma_atlas_height(atlas));
+    CHECK_ITEM(items[0], 0, 0, 16, 16);
+    CHECK_ITEM(items[1], 16, 0, 16, 16);
+    CHECK_ITEM(items[2], 32, 0, 16, 16);
+    sma_atlas_destroy(atlas);
+
+    // power of two sizes: 64x16, 32x32 and 16x64 have same area, most square one is picked
+    smol_size_constraints_t cons;
+    cons.power_of_two = true;
+    cons.threads = 2;
+    atlas = sma_atlas_find_min_size(sizes, 3, &cons, items);
+    CHECK(atlas != nullptr);
+    CHECK_EQ(32, sma_atlas_width(atlas));
+    CHECK_EQ(32, sma_atlas_height(atlas));
+    CHECK_ITEM(items[2], 0, 16, 16, 16);
+    sma_atlas_destroy(atlas);
+
+    // limited aspect ratio
+    cons = smol_size_constraints_t();
+    cons.max_aspect = 2.0f;
+    atlas = sma_atlas_find_min_size(sizes, 3, &cons, items);
+    CHECK(atlas != nullptr);
+    CHECK_EQ(32, sma_atlas_width(atlas));
+    CHECK_EQ(32, sma_atlas_height(atlas));
+    sma_atlas_destroy(atlas);
+
+    // does not fit
+    cons = smol_size_constraints_t();
+    cons.max_width = 40;
+    cons.max_height = 16;
+    CHECK(sma_atlas_find_min_size(sizes, 3, &cons, items) == nullptr);
+
+    // no items, or only empty ones
+    cons = smol_size_constraints_t();
+    CHECK(sma_atlas_find_min_size(nullptr, 0, &cons, nullptr) == nullptr);
+    cons.power_of_two = true;
+    smol_item_size_t empty[] = { {0, 0} };
+    atlas = sma_atlas_find_min_size(empty, 1, &cons, items);
+    CHECK(atlas != nullptr);
+    CHECK_EQ(1, sma_atlas_width(atlas));
+    CHECK_EQ(1, sma_atlas_height(atlas));
+    sma_atlas_destroy(atlas);
+
+    // both width and height are multiples of size step
+    cons = smol_size_constraints_t();
+    cons.size_step = 4;
+    smol_item_size_t odd[] = { {17, 5} };
+    atlas = sma_atlas_find_min_size(odd, 1, &cons, items);
+    CHECK(atlas != nullptr);
+    CHECK_EQ(20, sma_atlas_width(atlas));
+    CHECK_EQ(8, sma_atlas_height(atlas));
+    CHECK_ITEM(items[0], 0, 0, 17, 5);
+    sma_atlas_destroy(atlas);
+}
+
 int run_smol_atlas_tests()
 {
     printf("Run smol-atlas unit tests...\n");
@@ -279,6 +1315,26 @@ int run_smol_atlas_tests()
     test_pack_results_minimal_size();
     test_pack_shelf_coalescing();
     test_clear();
+    test_pack_best_fit_many_shelves();
+    test_slabs();
+    test_repack();
+    test_repack_stable();
+    test_repack_async();
+    test_pixels();
+    test_upload();
+    test_rotate();
+    test_subshelves();
+    test_skyline();
+    test_trim();
+    test_reserve_prewarm();
+    test_item_iteration();
+    test_pinned();
+    test_composite();
+    test_item_rect_concurrent_reads();
+    test_shared_atlas();
+    test_write_uvs();
+    test_item_resize();
+    test_find_min_size();
 
     return 0;
 }